@@ -0,0 +1,265 @@
+#include "fake_tree.hpp"
+#include "jetson_clocks.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+#ifdef __aarch64__
+#include <arm_neon.h>
+#endif
+
+using namespace jetson_clocks;
+
+// Measures the memory bandwidth each EMC operating point delivers: for every
+// available EMC freq, set it with set_emc_freq() and run STREAM-style copy,
+// scale and triad kernels on one thread per online cpu. The results are
+// printed and saved with save_emc_bandwidth_table(), from which
+// pick_emc_freq() chooses the lowest EMC freq that meets a bandwidth target.
+//
+//   jetson_clocks_bandwidth [-o table] [--size MiB] [--repeat n] [--power]
+//                           [--fake]
+//
+// --size is the size of each of the three arrays, which should be well
+// beyond the last-level cache. --power also reports the total rail power
+// while triad runs. --fake runs against the fake tree instead of the board,
+// which exercises the sweep but measures the same EMC freq throughout.
+namespace {
+
+struct Options {
+  std::string output = "emc_bandwidth.txt";
+  long int size_mib = 64;
+  int repeat = 10;
+  bool power = false;
+  bool fake = false;
+};
+
+const double scalar = 3.0;
+
+// The three STREAM kernels over [begin, end) of each array. On aarch64 they
+// are written with NEON; elsewhere the loops are left to the compiler's
+// vectorizer.
+void copy(const double *a, double *c, std::size_t begin, std::size_t end) {
+  std::size_t i = begin;
+#ifdef __aarch64__
+  for (; i + 2 <= end; i += 2) {
+    vst1q_f64(c + i, vld1q_f64(a + i));
+  }
+#endif
+  for (; i < end; ++i) {
+    c[i] = a[i];
+  }
+}
+
+void scale(double *b, const double *c, std::size_t begin, std::size_t end) {
+  std::size_t i = begin;
+#ifdef __aarch64__
+  for (; i + 2 <= end; i += 2) {
+    vst1q_f64(b + i, vmulq_n_f64(vld1q_f64(c + i), scalar));
+  }
+#endif
+  for (; i < end; ++i) {
+    b[i] = scalar * c[i];
+  }
+}
+
+void triad(double *a, const double *b, const double *c, std::size_t begin,
+           std::size_t end) {
+  std::size_t i = begin;
+#ifdef __aarch64__
+  float64x2_t s = vdupq_n_f64(scalar);
+  for (; i + 2 <= end; i += 2) {
+    vst1q_f64(a + i, vfmaq_f64(vld1q_f64(b + i), vld1q_f64(c + i), s));
+  }
+#endif
+  for (; i < end; ++i) {
+    a[i] = b[i] + scalar * c[i];
+  }
+}
+
+enum Kernel { kCopy, kScale, kTriad, kStop };
+
+// One worker per cpu, each owning a contiguous chunk of the arrays. Workers
+// spin (yielding) between rounds so that a round is timed without thread
+// wake-up latency.
+class Stream {
+public:
+  Stream(std::size_t n, int num_threads)
+      : a_(n), b_(n), c_(n), round_(0), done_(0), kernel_(kCopy) {
+    for (int t = 0; t < num_threads; ++t) {
+      std::size_t begin = n * t / num_threads;
+      std::size_t end = n * (t + 1) / num_threads;
+      threads_.emplace_back([this, begin, end] { work(begin, end); });
+    }
+    run(kTriad); // Fault the pages in on the threads that use them.
+  }
+
+  ~Stream() {
+    kernel_ = kStop;
+    round_.fetch_add(1, std::memory_order_release);
+    for (std::thread &thread : threads_) {
+      thread.join();
+    }
+  }
+
+  // Run one kernel on every worker and return the seconds it took.
+  double run(Kernel kernel) {
+    done_ = 0;
+    kernel_ = kernel;
+    auto start = std::chrono::steady_clock::now();
+    round_.fetch_add(1, std::memory_order_release);
+    while (done_.load(std::memory_order_acquire) <
+           static_cast<int>(threads_.size())) {
+      std::this_thread::yield();
+    }
+    auto stop = std::chrono::steady_clock::now();
+    return std::chrono::duration<double>(stop - start).count();
+  }
+
+  std::size_t size() const { return a_.size(); }
+
+private:
+  void work(std::size_t begin, std::size_t end) {
+    std::fill(a_.begin() + begin, a_.begin() + end, 1.0);
+    std::fill(b_.begin() + begin, b_.begin() + end, 2.0);
+    std::fill(c_.begin() + begin, c_.begin() + end, 0.0);
+    for (unsigned long int seen = 0;;) {
+      while (round_.load(std::memory_order_acquire) == seen) {
+        std::this_thread::yield();
+      }
+      ++seen;
+      Kernel kernel = kernel_;
+      switch (kernel) {
+      case kCopy:
+        copy(a_.data(), c_.data(), begin, end);
+        break;
+      case kScale:
+        scale(b_.data(), c_.data(), begin, end);
+        break;
+      case kTriad:
+        triad(a_.data(), b_.data(), c_.data(), begin, end);
+        break;
+      case kStop:
+        return;
+      }
+      done_.fetch_add(1, std::memory_order_acq_rel);
+    }
+  }
+
+  std::vector<double> a_, b_, c_;
+  std::vector<std::thread> threads_;
+  std::atomic<unsigned long int> round_;
+  std::atomic<int> done_;
+  Kernel kernel_;
+};
+
+// The best of repeat runs in GB/s, as STREAM reports it.
+double best_gbps(Stream &stream, Kernel kernel, int arrays, int repeat) {
+  double best = 0.0;
+  for (int r = 0; r < repeat; ++r) {
+    best = std::max(best, 1.0 / stream.run(kernel));
+  }
+  return best * arrays * sizeof(double) * stream.size() / 1e9;
+}
+
+double triad_power_mw(Stream &stream, int repeat) {
+  try {
+    EnergyReport report =
+        measure_energy([&] { stream.run(kTriad); }, repeat);
+    double mw = 0.0;
+    for (const RailEnergy &rail : report.rails) {
+      mw += rail.average_power_mw;
+    }
+    return mw;
+  } catch (JetsonClocksException &e) {
+    std::printf("  no rail power: %s\n", e.what());
+    return 0.0;
+  }
+}
+
+bool parse_options(int argc, char *argv[], Options &options) {
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    bool has_value = i + 1 < argc;
+    if (arg == "-o" && has_value) {
+      options.output = argv[++i];
+    } else if (arg == "--size" && has_value) {
+      options.size_mib = std::atol(argv[++i]);
+    } else if (arg == "--repeat" && has_value) {
+      options.repeat = std::atoi(argv[++i]);
+    } else if (arg == "--power") {
+      options.power = true;
+    } else if (arg == "--fake") {
+      options.fake = true;
+    } else {
+      return false;
+    }
+  }
+  return options.size_mib > 0 && options.repeat > 0;
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  Options options;
+  if (!parse_options(argc, argv, options)) {
+    std::printf("usage: %s [-o table] [--size MiB] [--repeat n] [--power] "
+                "[--fake]\n",
+                argv[0]);
+    return 2;
+  }
+
+  std::string root;
+  if (options.fake) {
+    root = "/dev/shm/jetson_clocks_bandwidth." + std::to_string(getpid());
+    make_fake_tree(root);
+    set_root_dir(root);
+  }
+
+  int status = 0;
+  try {
+    std::vector<long int> emc_freqs = get_emc_available_freqs();
+    int num_threads =
+        std::max(static_cast<int>(std::thread::hardware_concurrency()), 1);
+    std::size_t n = options.size_mib * 1024 * 1024 / sizeof(double);
+    Stream stream(n, num_threads);
+    ClockProfile before = read_profile();
+
+    std::printf("%d threads, 3 x %ld MiB arrays, best of %d\n", num_threads,
+                options.size_mib, options.repeat);
+    std::printf("  %12s %10s %10s %10s %10s\n", "emc MHz", "copy GB/s",
+                "scale GB/s", "triad GB/s", "power mW");
+    std::vector<EmcBandwidth> table;
+    for (long int emc_freq : emc_freqs) {
+      set_emc_freq(emc_freq);
+      EmcBandwidth row;
+      row.emc_freq = get_emc_freq();
+      row.copy_gbps = best_gbps(stream, kCopy, 2, options.repeat);
+      row.scale_gbps = best_gbps(stream, kScale, 2, options.repeat);
+      row.triad_gbps = best_gbps(stream, kTriad, 3, options.repeat);
+      if (options.power) {
+        row.power_mw = triad_power_mw(stream, options.repeat);
+      }
+      std::printf("  %12.1f %10.2f %10.2f %10.2f %10.0f\n",
+                  row.emc_freq / 1e6, row.copy_gbps, row.scale_gbps,
+                  row.triad_gbps, row.power_mw);
+      table.push_back(row);
+    }
+
+    apply_profile(before);
+    save_emc_bandwidth_table(options.output, table);
+    std::printf("saved %s\n", options.output.c_str());
+  } catch (JetsonClocksException &e) {
+    std::printf("FAILED: %s\n", e.what());
+    status = 1;
+  }
+
+  if (options.fake) {
+    remove_tree(root);
+  }
+  return status;
+}
@@ -0,0 +1,289 @@
+#include "fake_tree.hpp"
+#include "jetson_clocks.hpp"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+using namespace jetson_clocks;
+
+namespace {
+
+template <typename F> double ns_per_call(int iterations, F f) {
+  // Warm up caches and lazily opened handles before timing.
+  for (int i = 0; i < iterations / 10 + 1; ++i) {
+    f();
+  }
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < iterations; ++i) {
+    f();
+  }
+  auto stop = std::chrono::steady_clock::now();
+  return std::chrono::duration<double, std::nano>(stop - start).count() /
+         iterations;
+}
+
+template <typename F>
+void bench(const std::string &name, int iterations, F f) {
+  try {
+    double ns = ns_per_call(iterations, f);
+    std::printf("  %-40s %10.1f ns\n", name.c_str(), ns);
+  } catch (JetsonClocksException &e) {
+    std::printf("  %-40s unavailable: %s\n", name.c_str(), e.what());
+  }
+}
+
+// The write path before attribute handles: an existence check, a
+// truncating fopen() and a third open through std::ofstream. The FILE* is
+// closed here so the benchmark does not run out of descriptors.
+void legacy_write_file(const std::string &name, const std::string &str) {
+  std::string path = get_root_dir() + name;
+  std::ifstream f(path.c_str());
+  if (!f.good()) {
+    return;
+  }
+  FILE *fp = fopen(path.c_str(), "w");
+  if (fp == NULL) {
+    return;
+  }
+  fclose(fp);
+  std::ofstream out(path.c_str());
+  out << str;
+}
+
+volatile long int sink;
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  int iterations = argc > 1 ? std::atoi(argv[1]) : 100000;
+
+  std::string root =
+      "/dev/shm/jetson_clocks_bench." + std::to_string(getpid());
+  make_fake_tree(root);
+  set_root_dir(root);
+
+  const std::string cur_freq =
+      "/sys/devices/system/cpu/cpu0/cpufreq/scaling_cur_freq";
+
+  std::printf("per-read cost (%d iterations, fake tree in %s)\n",
+              iterations, root.c_str());
+  bench("read_file() + stoi (before)", iterations, [&] {
+    sink = std::stoi(read_file(cur_freq));
+  });
+  bench("attribute().read_long() (after)", iterations, [&] {
+    sink = attribute(cur_freq).read_long();
+  });
+  bench("get_cpu_cur_freq()", iterations, [] {
+    sink = get_cpu_cur_freq(0);
+  });
+  bench("get_gpu_cur_freq()", iterations, [] {
+    sink = get_gpu_cur_freq();
+  });
+  bench("get_emc_freq()", iterations, [] {
+    sink = get_emc_freq();
+  });
+  bench("get_fan_speed()", iterations, [] {
+    sink = get_fan_speed();
+  });
+  bench("get_cpu_ids()", iterations, [] {
+    sink = get_cpu_ids().size();
+  });
+  bench("get_cpu_available_freqs() copy", iterations, [] {
+    sink = get_cpu_available_freqs(0).size();
+  });
+  bench("get_cpu_freq_table() view", iterations, [] {
+    sink = get_cpu_freq_table(0).size();
+  });
+
+  bench("snapshot() with pread (default)", iterations, [] {
+    static Snapshot s;
+    snapshot(s);
+    sink = s.emc_freq;
+  });
+  set_snapshot_backend(ReadBackend::io_uring);
+  if (ReadBatch({get_platform().emc_rate}, ReadBackend::io_uring).backend() ==
+      ReadBackend::io_uring) {
+    bench("snapshot() with io_uring", iterations, [] {
+      static Snapshot s;
+      snapshot(s);
+      sink = s.emc_freq;
+    });
+  } else {
+    std::printf("  %-40s unavailable\n", "snapshot() with io_uring");
+  }
+  set_snapshot_backend(ReadBackend::pread);
+  {
+    std::string segment =
+        "jetson_clocks_bench_telemetry." + std::to_string(getpid());
+    TelemetryPublisher publisher(segment);
+    publisher.publish();
+    TelemetryReader reader(segment);
+    bench("TelemetryReader::latest()", iterations, [&] {
+      static Snapshot s;
+      reader.latest(s);
+      sink = s.emc_freq;
+    });
+  }
+  try {
+    EffectiveFreqMonitor monitor;
+    bench("EffectiveFreqMonitor::sample()", iterations, [&] {
+      static Snapshot s;
+      monitor.sample(s);
+      sink = s.cpus[0].effective_freq;
+    });
+  } catch (JetsonClocksException &e) {
+    std::printf("  %-40s unavailable: %s\n", "EffectiveFreqMonitor::sample()",
+                e.what());
+  }
+  bench("equivalent getter calls", iterations / 10, [] {
+    for (int cpu_id : get_cpu_ids()) {
+      sink = get_cpu_cur_freq(cpu_id);
+      sink = get_cpu_min_freq(cpu_id);
+      sink = get_cpu_max_freq(cpu_id);
+      sink = get_cpu_governor(cpu_id).size();
+    }
+    sink = get_gpu_cur_freq();
+    sink = get_gpu_min_freq();
+    sink = get_gpu_max_freq();
+    sink = get_emc_freq();
+    sink = get_fan_speed();
+  });
+
+  // Every attribute a snapshot reads, read through each backend.
+  std::vector<Attribute *> attrs;
+  const Platform &platform = get_platform();
+  for (int cpu_id : platform.possible_cpu_ids) {
+    attrs.push_back(platform.cpus[cpu_id].cur_freq);
+  }
+  for (const CpuAttributes &policy : platform.policies) {
+    attrs.push_back(policy.min_freq);
+    attrs.push_back(policy.max_freq);
+    attrs.push_back(policy.governor);
+  }
+  for (Attribute *attr : {platform.gpu_cur_freq, platform.gpu_min_freq,
+                          platform.gpu_max_freq, platform.emc_rate,
+                          platform.fan_pwm}) {
+    attrs.push_back(attr);
+  }
+
+  std::printf("batched read of %zu attributes (%d iterations)\n",
+              attrs.size(), iterations / 10);
+  bench("sequential read_file() (before)", iterations / 10, [&] {
+    for (Attribute *attr : attrs) {
+      sink = read_file(attr->path()).size();
+    }
+  });
+  ReadBatch pread_batch(attrs, ReadBackend::pread);
+  bench("ReadBatch pread", iterations / 10, [&] {
+    pread_batch.read_all();
+  });
+  ReadBatch uring_batch(attrs, ReadBackend::io_uring);
+  if (uring_batch.backend() == ReadBackend::io_uring) {
+    bench("ReadBatch io_uring", iterations / 10, [&] {
+      uring_batch.read_all();
+    });
+  } else {
+    std::printf("  %-40s unavailable\n", "ReadBatch io_uring");
+  }
+
+  const std::string max_freq =
+      "/sys/devices/system/cpu/cpu0/cpufreq/scaling_max_freq";
+
+  std::printf("per-write cost (%d iterations)\n", iterations);
+  bench("legacy write_file() (before)", iterations, [&] {
+    legacy_write_file(max_freq, std::to_string(2265600));
+  });
+  bench("attribute().write_long() (after)", iterations, [&] {
+    attribute(max_freq).write_long(2265600);
+  });
+  bench("set_cpu_max_freq()", iterations, [] {
+    set_cpu_max_freq(0, 2265600);
+  });
+  bench("set_gpu_freq_range()", iterations, [] {
+    set_gpu_freq_range(114750000, 1377000000);
+  });
+  bench("set_emc_freq()", iterations, [] {
+    set_emc_freq(2133000000);
+  });
+  bench("snap_cpu_max_freq() arbitrary target", iterations, [] {
+    sink = snap_cpu_max_freq(0, 2200000);
+  });
+
+  std::printf("profile change on %d cpus (%d iterations)\n", kNumCpus,
+              iterations / 10);
+  bench("per-cpu set_cpu_*() (before)", iterations / 10, [] {
+    for (int cpu_id : get_cpu_ids()) {
+      set_cpu_min_freq(cpu_id, 1190400);
+      set_cpu_max_freq(cpu_id, 2265600);
+      set_cpu_governor(cpu_id, "schedutil");
+    }
+  });
+  bench("per-cluster set_cluster_*() (after)", iterations / 10, [] {
+    for (const CpuCluster &cluster : get_cpu_clusters()) {
+      set_cluster_min_freq(cluster.policy_id, 1190400);
+      set_cluster_max_freq(cluster.policy_id, 2265600);
+      set_cluster_governor(cluster.policy_id, "schedutil");
+    }
+  });
+
+  ClockProfile idle = read_profile();
+  ClockProfile boost = max_performance_profile();
+  std::printf("full profile switch (%d iterations)\n", iterations / 10);
+  bench("unconditional setters (before)", iterations / 10, [] {
+    set_fan_speed(255);
+    set_gpu_freq_range(1377000000, 1377000000);
+    set_emc_freq(2133000000);
+    for (const CpuCluster &cluster : get_cpu_clusters()) {
+      set_cluster_max_freq(cluster.policy_id, 2265600);
+      set_cluster_min_freq(cluster.policy_id, 2265600);
+      set_cluster_governor(cluster.policy_id, "performance");
+    }
+  });
+  bench("apply_profile() unchanged", iterations / 10, [&] {
+    sink = apply_profile(boost).writes.size();
+  });
+  std::vector<unsigned char> state = save_state();
+  bench("restore_state() unchanged", iterations / 10, [&] {
+    sink = restore_state(state).writes.size();
+  });
+  bool boosted = false;
+  bench("apply_profile() alternating", iterations / 10, [&] {
+    boosted = !boosted;
+    sink = apply_profile(boosted ? boost : idle).writes.size();
+  });
+
+  std::printf("scoped boost (%d iterations)\n", iterations / 10);
+  bench("ScopedBoost enter/exit", iterations / 10, [] {
+    ScopedBoost boost;
+  });
+  {
+    ScopedBoost outer;
+    bench("nested ScopedBoost enter/exit", iterations / 10, [] {
+      ScopedBoost boost;
+    });
+  }
+
+  std::printf("energy per call (100 iterations of a 1 ms busy loop)\n");
+  EnergyReport energy = measure_energy(
+      [] {
+        auto until =
+            std::chrono::steady_clock::now() + std::chrono::milliseconds(1);
+        while (std::chrono::steady_clock::now() < until) {
+        }
+      },
+      100);
+  for (const RailEnergy &rail : energy.rails) {
+    std::printf("  %-40s %10.3f mJ %8.1f mW\n", rail.rail.name.c_str(),
+                rail.energy_per_iteration_j * 1000, rail.average_power_mw);
+  }
+  std::printf("  %llu rail readings, %llu dropped\n", energy.samples,
+              energy.dropped);
+
+  remove_tree(root);
+  return 0;
+}
@@ -48,31 +48,47 @@ int main(int argc, char *argv[]) {
     std::cout << "-------------------------------------------------------------"
               << std::endl;
 
-    // Test CPU Controls
-    auto cpu_ids = get_cpu_ids();
-    for (const auto &cpu_id : cpu_ids) {
-      std::cout << "CPU ID: " << cpu_id << std::endl;
+    // Test CPU Cluster Controls
+    auto clusters = get_cpu_clusters();
+    for (const auto &cluster : clusters) {
+      std::cout << "CLUSTER " << cluster.policy_id << " (" << cluster.name
+                << ") CPUS: ";
+      for (const auto &cpu_id : cluster.cpu_ids) {
+        std::cout << cpu_id << " ";
+      }
+      std::cout << std::endl;
 
-      auto available_freqs = get_cpu_available_freqs(cpu_id);
+      auto available_freqs = get_cluster_available_freqs(cluster.policy_id);
       std::cout << "AVAILABLE FREQS: ";
       for (const auto &f : available_freqs) {
         std::cout << f/1.0e3 << "MHz ";
       }
       std::cout << std::endl;
 
-      auto available_governors = get_cpu_available_governors(cpu_id);
+      auto available_governors =
+          get_cluster_available_governors(cluster.policy_id);
       std::cout << "AVAILABLE GOVS: ";
       for (const auto &g : available_governors) {
         std::cout << g << " ";
       }
       std::cout << std::endl;
 
+      // One write per cluster covers every cpu in it.
       if (available_freqs.size() != 0) {
-        set_cpu_min_freq(cpu_id, available_freqs[0]);
-        set_cpu_max_freq(cpu_id, available_freqs[available_freqs.size() - 1]);
+        set_cluster_min_freq(cluster.policy_id, available_freqs[0]);
+        set_cluster_max_freq(cluster.policy_id,
+                             available_freqs[available_freqs.size() - 1]);
       }
-      set_cpu_governor(cpu_id, "performance");
+      set_cluster_governor(cluster.policy_id, "performance");
+      std::cout << std::endl;
+    }
+    std::cout << "-------------------------------------------------------------"
+              << std::endl;
 
+    // Test CPU Controls
+    auto cpu_ids = get_cpu_ids();
+    for (const auto &cpu_id : cpu_ids) {
+      std::cout << "CPU ID: " << cpu_id << std::endl;
       std::cout << "MIN FREQ: " << get_cpu_min_freq(cpu_id) << std::endl;
       std::cout << "MAX FREQ: " << get_cpu_max_freq(cpu_id) << std::endl;
       std::cout << "CUR FREQ: " << get_cpu_cur_freq(cpu_id) << std::endl;
@@ -0,0 +1,145 @@
+#ifndef JETSON_CLOCKS_FAKE_TREE_HPP_
+#define JETSON_CLOCKS_FAKE_TREE_HPP_
+
+#include <fstream>
+#include <ftw.h>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Builds a fake Jetson AGX Xavier (tegra194) sysfs/debugfs tree on tmpfs so
+// the library can be benchmarked without the hardware. Point the library at
+// it with set_root_dir().
+namespace {
+
+const int kNumCpus = 8;
+
+void make_dirs(const std::string &path) {
+  for (std::size_t i = 1; i < path.size(); ++i) {
+    if (path[i] == '/') {
+      mkdir(path.substr(0, i).c_str(), 0755);
+    }
+  }
+  mkdir(path.c_str(), 0755);
+}
+
+void put(const std::string &root, const std::string &path,
+         const std::string &contents) {
+  make_dirs(root + path.substr(0, path.rfind('/')));
+  std::ofstream out((root + path).c_str());
+  out << contents;
+}
+
+void make_fake_tree(const std::string &root) {
+  put(root, "/proc/device-tree/compatible",
+      std::string("nvidia,p2972-0000\0nvidia,tegra194\0", 35));
+  put(root, "/proc/device-tree/model", "Jetson-AGX\n");
+
+  std::string cpus = "0-" + std::to_string(kNumCpus - 1) + "\n";
+  put(root, "/sys/devices/system/cpu/possible", cpus);
+  put(root, "/sys/devices/system/cpu/present", cpus);
+  put(root, "/sys/devices/system/cpu/online", cpus);
+  // Xavier has four clusters of two Carmel cores. Like the kernel, each
+  // cpuN/cpufreq is a link to the policy directory of its cluster.
+  for (int policy = 0; policy < kNumCpus; policy += 2) {
+    std::string dir =
+        "/sys/devices/system/cpu/cpufreq/policy" + std::to_string(policy) + "/";
+    put(root, dir + "related_cpus", std::to_string(policy) + " " +
+                                        std::to_string(policy + 1) + "\n");
+    put(root, dir + "scaling_available_frequencies",
+        "115200 192000 268800 345600 422400 499200 576000 652800 729600 "
+        "806400 883200 960000 1036800 1113600 1190400 1267200 1344000 "
+        "1420800 1497600 1574400 1651200 1728000 1804800 1881600 1958400 "
+        "2035200 2112000 2188800 2265600 \n");
+    put(root, dir + "scaling_available_governors",
+        "interactive conservative ondemand userspace powersave performance "
+        "schedutil \n");
+    put(root, dir + "scaling_governor", "schedutil\n");
+    put(root, dir + "scaling_min_freq", "1190400\n");
+    put(root, dir + "scaling_max_freq", "2265600\n");
+    put(root, dir + "scaling_cur_freq", "1907200\n");
+  }
+  for (int cpu = 0; cpu < kNumCpus; ++cpu) {
+    std::string dir = "/sys/devices/system/cpu/cpu" + std::to_string(cpu);
+    put(root, dir + "/regs/identification/midr_el1", "0x000000004e0f0040\n");
+    std::string policy = "../cpufreq/policy" + std::to_string(cpu - cpu % 2);
+    symlink(policy.c_str(), (root + dir + "/cpufreq").c_str());
+  }
+
+  std::string gpu = "/sys/devices/17000000.gv11b/devfreq/17000000.gv11b/";
+  put(root, gpu + "available_frequencies",
+      "114750000 216750000 318750000 420750000 522750000 624750000 726750000 "
+      "828750000 930750000 1032750000 1134750000 1236750000 1338750000 "
+      "1377000000\n");
+  put(root, gpu + "min_freq", "114750000\n");
+  put(root, gpu + "max_freq", "1377000000\n");
+  put(root, gpu + "cur_freq", "114750000\n");
+  put(root, gpu + "device/railgate_enable", "1\n");
+  put(root, gpu + "device/load", "0\n");
+  make_dirs(root + "/sys/class/devfreq");
+  symlink("../../devices/17000000.gv11b/devfreq/17000000.gv11b",
+          (root + "/sys/class/devfreq/17000000.gv11b").c_str());
+
+  std::string emc = "/sys/kernel/debug/bpmp/debug/clk/emc/";
+  put(root, emc + "rate", "2133000000\n");
+  put(root, emc + "min_rate", "204000000\n");
+  put(root, emc + "max_rate", "2133000000\n");
+  put(root, emc + "mrq_rate_locked", "0\n");
+  put(root, emc + "possible_rates",
+      "204000 408000 665600 800000 1065600 1331200 1600000 1866000 2133000 "
+      "(kHz)\n");
+  put(root, "/sys/kernel/nvpmodel_emc_cap/emc_iso_cap", "0\n");
+
+  put(root, "/sys/kernel/debug/tegra_fan/target_pwm", "77\n");
+  put(root, "/sys/module/qos/parameters/enable", "1\n");
+
+  // Two INA3221s with three rails each, as the L4T 32 iio driver shows them.
+  const char *rails[2][3] = {{"GPU", "CPU", "SOC"}, {"CV", "VDDRQ", "SYS5V"}};
+  for (int device = 0; device < 2; ++device) {
+    std::string dir = "/sys/bus/i2c/drivers/ina3221x/1-004" +
+                      std::to_string(device) + "/iio:device" +
+                      std::to_string(device) + "/";
+    for (int channel = 0; channel < 3; ++channel) {
+      std::string n = std::to_string(channel);
+      int ma = 100 * (3 * device + channel + 1);
+      put(root, dir + "rail_name_" + n, std::string(rails[device][channel]) +
+                                            "\n");
+      put(root, dir + "in_voltage" + n + "_input", "5000\n");
+      put(root, dir + "in_current" + n + "_input", std::to_string(ma) + "\n");
+      put(root, dir + "in_power" + n + "_input",
+          std::to_string(5 * ma) + "\n");
+    }
+  }
+
+  // The GPU zone's first trip point only turns the fan up.
+  std::string zone = "/sys/class/thermal/thermal_zone";
+  put(root, zone + "0/type", "CPU-therm\n");
+  put(root, zone + "0/temp", "45500\n");
+  put(root, zone + "0/policy", "step_wise\n");
+  put(root, zone + "0/trip_point_0_temp", "96800\n");
+  put(root, zone + "0/trip_point_0_type", "critical\n");
+  put(root, zone + "0/trip_point_1_temp", "90000\n");
+  put(root, zone + "0/trip_point_1_type", "passive\n");
+  put(root, zone + "1/type", "GPU-therm\n");
+  put(root, zone + "1/temp", "44000\n");
+  put(root, zone + "1/policy", "step_wise\n");
+  put(root, zone + "1/trip_point_0_temp", "50000\n");
+  put(root, zone + "1/trip_point_0_type", "active\n");
+  put(root, zone + "1/trip_point_1_temp", "96800\n");
+  put(root, zone + "1/trip_point_1_type", "critical\n");
+  put(root, zone + "2/type", "Tboard_tegra\n");
+  put(root, zone + "2/temp", "38000\n");
+  put(root, zone + "2/policy", "user_space\n");
+}
+
+int remove_entry(const char *path, const struct stat *, int, struct FTW *) {
+  return remove(path);
+}
+
+void remove_tree(const std::string &root) {
+  nftw(root.c_str(), remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+}
+
+} // namespace
+
+#endif
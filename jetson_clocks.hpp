@@ -21,9 +21,10 @@
 // Jetson Nano, but I will happily accept pull requests to
 // fix bugs on any platform.
 //
-// This code is not thread safe (yet?). Do not manipulate power
-// state across multiple threads without implementing your own
-// synchronization.
+// Every function may be called from any thread. Writers of one
+// clock domain (a cpufreq policy, the GPU, EMC, the fan) serialize
+// on that domain's lock, and reads never lock. set_root_dir() is the
+// exception: call it before anything else.
 //
 // License:
 //   Copyright (c) 2019 Jordan Ford
@@ -56,15 +57,60 @@
 //                    INTERFACE                           //
 //--------------------------------------------------------//
 
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <future>
+#include <memory>
 #include <stdexcept>
 #include <string>
+#include <thread>
+#include <utility>
 #include <vector>
 
 namespace jetson_clocks {
 
+/// A read-only view of a sorted table that the library reads once and
+/// keeps for the life of the process. Views never allocate.
+template <typename T> class Span {
+public:
+  Span() : data_(nullptr), size_(0) {}
+  Span(const T *data, std::size_t size) : data_(data), size_(size) {}
+  Span(const std::vector<T> &values)
+      : data_(values.data()), size_(values.size()) {}
+
+  const T *begin() const { return data_; }
+  const T *end() const { return data_ + size_; }
+  std::size_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+  const T &operator[](std::size_t i) const { return data_[i]; }
+  const T &front() const { return data_[0]; }
+  const T &back() const { return data_[size_ - 1]; }
+
+  /// Check if value is in the table with a binary search.
+  bool contains(const T &value) const {
+    return std::binary_search(begin(), end(), value);
+  }
+
+  /// Copy the table into a vector.
+  std::vector<T> to_vector() const { return std::vector<T>(begin(), end()); }
+
+private:
+  const T *data_;
+  std::size_t size_;
+};
+
 /// Check if this process is running with root user permissions.
 bool running_as_root();
 
+/// Prefix every sysfs, debugfs and procfs path with dir. This lets the
+/// library run against a fake tree for testing and benchmarking. It must
+/// be called before any other function.
+void set_root_dir(const std::string &dir);
+
+/// Get the prefix applied to every sysfs, debugfs and procfs path.
+const std::string &get_root_dir();
+
 /// Determine the SOC family of this board.
 std::string get_soc_family();
 
@@ -80,6 +126,9 @@ unsigned char get_fan_speed();
 /// Get all available GPU clock frequencies.
 std::vector<long int> get_gpu_available_freqs();
 
+/// Get all available GPU clock frequencies, sorted, without copying.
+Span<long int> get_gpu_freq_table();
+
 /// Set the GPU min and max frequencies.
 void set_gpu_freq_range(long int min_freq, long int max_freq);
 
@@ -87,32 +136,97 @@ void set_gpu_freq_range(long int min_freq, long int max_freq);
 long int get_gpu_cur_freq();
 
 /// Get the minimum GPU clock freq.
-long int get_gpu_min_speed();
+long int get_gpu_min_freq();
 
 /// Get the maximum GPU clock freq.
+long int get_gpu_max_freq();
+
+/// Get the minimum GPU clock freq. Same as get_gpu_min_freq().
+long int get_gpu_min_speed();
+
+/// Get the maximum GPU clock freq. Same as get_gpu_max_freq().
 long int get_gpu_max_speed();
 
 /// Get the current GPU usage.
 int get_gpu_current_usage();
 
-/// Get the allowed EMC clock freqs.
+/// Get the names of every devfreq device, such as "17000000.gv11b" for the
+/// GPU.
+std::vector<std::string> get_devfreq_devices();
+
+/// Get the available clock frequencies of a devfreq device, sorted, without
+/// copying.
+Span<long int> get_devfreq_freq_table(const std::string &device);
+
+/// Get the current clock freq of a devfreq device.
+long int get_devfreq_cur_freq(const std::string &device);
+
+/// Get the minimum clock freq of a devfreq device.
+long int get_devfreq_min_freq(const std::string &device);
+
+/// Get the maximum clock freq of a devfreq device.
+long int get_devfreq_max_freq(const std::string &device);
+
+/// Get the allowed EMC clock freqs: the operating points of the EMC DVFS
+/// table, or only the minimum and maximum where the table cannot be read.
 std::vector<long int> get_emc_available_freqs();
 
-/// Set the EMC clock freq.
+/// Get the allowed EMC clock freqs without copying. Unlike
+/// get_emc_available_freqs(), these ignore the nvpmodel EMC cap, which can
+/// change at runtime.
+Span<long int> get_emc_freq_table();
+
+/// Set the EMC clock freq. Freqs between operating points are rounded up to
+/// the next one, as the BPMP would.
 void set_emc_freq(long int freq);
 
 /// Get the EMC clock freq.
 long int get_emc_freq();
 
-/// Get the ids of all cpus.
+/// The memory bandwidth measured at one EMC operating point by the
+/// jetson_clocks_bandwidth tool.
+struct EmcBandwidth {
+  long int emc_freq = 0;   // Hz
+  double copy_gbps = 0.0;  // STREAM copy, c = a.
+  double scale_gbps = 0.0; // STREAM scale, b = s * c.
+  double triad_gbps = 0.0; // STREAM triad, a = b + s * c.
+  double power_mw = 0.0;   // Total rail power during triad, 0 if unmeasured.
+};
+
+/// Save a bandwidth table as text, one operating point per line.
+void save_emc_bandwidth_table(const std::string &path,
+                              const std::vector<EmcBandwidth> &table);
+
+/// Load a bandwidth table saved by save_emc_bandwidth_table(), sorted by
+/// EMC freq.
+std::vector<EmcBandwidth> load_emc_bandwidth_table(const std::string &path);
+
+/// Get the lowest EMC freq whose triad bandwidth is at least gbps, or the
+/// fastest one if none is.
+long int pick_emc_freq(const std::vector<EmcBandwidth> &table, double gbps);
+
+/// Get the ids of all online cpus.
 std::vector<int> get_cpu_ids();
 
-/// Get the available governors for a given cpu.
+/// Get the ids of all cpus present on this board, online or not.
+std::vector<int> get_present_cpu_ids();
+
+/// Parse a kernel cpu list such as "0-3,5,7-11" into ascending cpu ids.
+std::vector<int> parse_cpu_list(const char *str);
+
+/// Get the available governors for a given cpu, in the kernel's order.
 std::vector<std::string> get_cpu_available_governors(int cpu_id);
 
 /// Get the available clock frequencies for a given cpu.
 std::vector<long int> get_cpu_available_freqs(int cpu_id);
 
+/// Get the available governors for a given cpu, sorted, without copying.
+Span<std::string> get_cpu_governor_table(int cpu_id);
+
+/// Get the available clock frequencies for a given cpu, sorted, without
+/// copying.
+Span<long int> get_cpu_freq_table(int cpu_id);
+
 /// Get the current clock governor for a given cpu.
 std::string get_cpu_governor(int cpu_id);
 
@@ -125,6 +239,10 @@ long int get_cpu_max_freq(int cpu_id);
 /// Get the current clock frequency for a given cpu.
 long int get_cpu_cur_freq(int cpu_id);
 
+/// Get the clock frequency a given cpu actually ran at (kHz) while it was
+/// busy during interval_us, from its cycle counter. See EffectiveFreqMonitor.
+long int get_cpu_effective_freq(int cpu_id, long int interval_us = 100000);
+
 /// Set the clock governor for a given cpu.
 void set_cpu_governor(int cpu_id, const std::string &gov);
 
@@ -134,6 +252,1161 @@ void set_cpu_min_freq(int cpu_id, long int min_freq);
 /// Set the maximum clock frequency for a given cpu.
 void set_cpu_max_freq(int cpu_id, long int max_freq);
 
+/// A group of cpus that share one cpufreq policy, and so one clock.
+struct CpuCluster {
+  int policy_id;             // The N in /sys/devices/system/cpu/cpufreq/policyN.
+  std::string name;          // The core type, e.g. "Denver" or "Cortex-A57".
+  std::vector<int> cpu_ids;  // All cpus in the cluster, online or not.
+};
+
+/// Get the cpu clusters of this board.
+std::vector<CpuCluster> get_cpu_clusters();
+
+/// Get the available clock frequencies for a given cluster.
+std::vector<long int> get_cluster_available_freqs(int policy_id);
+
+/// Get the available governors for a given cluster, in the kernel's order.
+std::vector<std::string> get_cluster_available_governors(int policy_id);
+
+/// Get the available governors for a given cluster, sorted, without copying.
+Span<std::string> get_cluster_governor_table(int policy_id);
+
+/// Get the available clock frequencies for a given cluster, sorted, without
+/// copying.
+Span<long int> get_cluster_freq_table(int policy_id);
+
+/// Get the current clock governor for a given cluster.
+std::string get_cluster_governor(int policy_id);
+
+/// Get the current minimum clock frequency for a given cluster.
+long int get_cluster_min_freq(int policy_id);
+
+/// Get the current maximum clock frequency for a given cluster.
+long int get_cluster_max_freq(int policy_id);
+
+/// Get the current clock frequency for a given cluster.
+long int get_cluster_cur_freq(int policy_id);
+
+/// Set the clock governor for every cpu in a given cluster.
+void set_cluster_governor(int policy_id, const std::string &gov);
+
+/// Set the minimum clock frequency for every cpu in a given cluster.
+void set_cluster_min_freq(int policy_id, long int min_freq);
+
+/// Set the maximum clock frequency for every cpu in a given cluster.
+void set_cluster_max_freq(int policy_id, long int max_freq);
+
+/// How an arbitrary target frequency is rounded to an available one.
+enum class Rounding {
+  floor,  // The highest available frequency at or below the target.
+  ceil,   // The lowest available frequency at or above the target.
+  nearest // The closest available frequency, preferring the lower on a tie.
+};
+
+/// Snap target to an entry of a sorted frequency table in O(log n).
+/// Targets outside the table snap to its first or last entry.
+long int snap_freq(Span<long int> table, long int target,
+                   Rounding rounding = Rounding::nearest);
+
+/// Get the frequency that is a fraction (0 to 1) of the highest entry in a
+/// frequency table, for use as a snapping target.
+long int fraction_of_max(Span<long int> table, double fraction);
+
+/// Set the minimum clock frequency for a given cpu to the available
+/// frequency nearest target (kHz). Returns the frequency that was set.
+long int snap_cpu_min_freq(int cpu_id, long int target,
+                           Rounding rounding = Rounding::nearest);
+
+/// Set the maximum clock frequency for a given cpu to the available
+/// frequency nearest target (kHz). Returns the frequency that was set.
+long int snap_cpu_max_freq(int cpu_id, long int target,
+                           Rounding rounding = Rounding::nearest);
+
+/// Set the minimum clock frequency for a given cluster to the available
+/// frequency nearest target (kHz). Returns the frequency that was set.
+long int snap_cluster_min_freq(int policy_id, long int target,
+                               Rounding rounding = Rounding::nearest);
+
+/// Set the maximum clock frequency for a given cluster to the available
+/// frequency nearest target (kHz). Returns the frequency that was set.
+long int snap_cluster_max_freq(int policy_id, long int target,
+                               Rounding rounding = Rounding::nearest);
+
+/// Set the GPU min and max frequencies to the available frequencies nearest
+/// the targets (Hz). Returns the {min, max} that were set.
+std::pair<long int, long int>
+snap_gpu_freq_range(long int min_target, long int max_target,
+                    Rounding rounding = Rounding::nearest);
+
+/// The settings of one cpufreq policy in a ClockProfile.
+/// Empty or zero fields are left as they are.
+struct PolicyProfile {
+  int policy_id = 0;
+  std::string governor;
+  long int min_freq = 0; // kHz
+  long int max_freq = 0; // kHz
+};
+
+/// A clock configuration covering every domain this library controls.
+/// Fields left at their defaults are not touched when it is applied.
+struct ClockProfile {
+  std::vector<PolicyProfile> policies;
+  long int gpu_min_freq = 0; // Hz
+  long int gpu_max_freq = 0; // Hz
+  int gpu_railgate = -1;     // 0 or 1
+  long int emc_freq = 0;     // Hz, implies emc_override = 1
+  int emc_override = -1;     // 0 or 1, 0 hands EMC back to the governor
+  int fan_speed = -1;        // 0 to 255
+  int cpu_qos = -1;          // 0 or 1
+  /// For SOCs with a cc3 idle state, 0 or 1 for each cluster's cc3 enable
+  /// (or -1 to leave one alone), in the order get_platform() lists them.
+  std::vector<int> cc3;
+};
+
+/// One attribute write made by apply_profile().
+struct ProfileWrite {
+  std::string path;
+  std::string value;
+  int error; // Zero on success, otherwise the errno of the write.
+};
+
+/// What apply_profile() did.
+struct ApplyReport {
+  std::vector<ProfileWrite> writes; // In the order they were made.
+  int unchanged = 0;         // Attributes that already had their value.
+  bool rolled_back = false;  // A write failed and earlier ones were undone.
+
+  /// Check if every write succeeded.
+  bool ok() const;
+};
+
+/// Get the profile the jetson_clocks script applies: every cluster, the GPU
+/// and EMC at their highest frequency, the fan at full speed and cpu qos
+/// and cc3 disabled.
+ClockProfile max_performance_profile();
+
+/// Read the current settings of every domain into a profile. Settings that
+/// cannot be read are left at their defaults.
+ClockProfile read_profile();
+
+/// Apply a profile, writing only the attributes whose value differs.
+/// Everything is validated and the current state read before the first
+/// write, so an invalid profile throws without changing anything. Writes
+/// are ordered so that no min/max pair is ever inverted; if the kernel
+/// rejects one, the writes already made are undone in reverse order.
+ApplyReport apply_profile(const ClockProfile &profile);
+
+/// Save the current settings of every domain (see read_profile()) as a
+/// small versioned binary blob.
+std::vector<unsigned char> save_state();
+
+/// Save the current settings of every domain to a file.
+void save_state(const std::string &path);
+
+/// Restore settings saved by save_state() on this SOC family, through
+/// apply_profile(). Restoring a board that has not changed makes no writes.
+ApplyReport restore_state(const std::vector<unsigned char> &state);
+
+/// Restore settings saved by save_state() to a file.
+ApplyReport restore_state(const std::string &path);
+
+/// The clock domains a ScopedBoost raises. Combine them with |.
+enum class BoostDomain : unsigned {
+  cpu = 1, // Every cluster's min and max at its highest frequency.
+  gpu = 2, // The GPU min and max at its highest frequency.
+  emc = 4, // EMC overridden to its highest allowed rate.
+  all = 7
+};
+
+constexpr BoostDomain operator|(BoostDomain a, BoostDomain b) {
+  return static_cast<BoostDomain>(static_cast<unsigned>(a) |
+                                  static_cast<unsigned>(b));
+}
+
+/// Raises clock domains to their maximum for the lifetime of the object.
+///
+/// Boosts are reference counted per domain across all threads: the first
+/// guard to raise a domain records what it wrote, and the last one to
+/// release it writes back the previous values. Nested and overlapping
+/// guards therefore never undo each other. A limit someone else set while
+/// the boost was held is kept.
+class ScopedBoost {
+public:
+  explicit ScopedBoost(BoostDomain domains = BoostDomain::all);
+  ~ScopedBoost();
+
+  ScopedBoost(const ScopedBoost &) = delete;
+  ScopedBoost &operator=(const ScopedBoost &) = delete;
+
+private:
+  unsigned held_; // The domains this guard holds a reference to.
+};
+
+/// One channel of an on-module INA3221 power monitor.
+struct PowerRail {
+  std::string name;   // As the board labels it, e.g. "VDD_SYS_GPU" or "GPU".
+  std::string domain; // The same rail named alike on every board, e.g.
+                      // "VDD_GPU" or "VDD_IN", or empty if unknown.
+};
+
+/// A measurement of one power rail.
+struct PowerReading {
+  long int voltage_mv;
+  long int current_ma;
+  long int power_mw;
+};
+
+/// Get the power rails of this board, in the order snapshots list them.
+std::vector<PowerRail> get_power_rails();
+
+/// Measure a power rail, given its name or domain.
+PowerReading get_power_reading(const std::string &rail);
+
+/// Get the power drawn through a rail (mW), given its name or domain.
+long int get_power_mw(const std::string &rail);
+
+/// A trip point of a thermal zone.
+struct TripPoint {
+  long int temp_mc;  // m°C
+  std::string type;  // "passive", "active", "hot" or "critical".
+};
+
+/// A thermal zone. Its trip points and policy are read once.
+struct ThermalZone {
+  int zone_id;          // The N in /sys/class/thermal/thermal_zoneN.
+  std::string type;     // As the kernel names it, e.g. "GPU-therm".
+  std::string domain;   // The same sensor named alike on every SOC, e.g.
+                        // "GPU", "AUX", "PLL" or "Tboard", or empty if
+                        // unknown.
+  std::string policy;   // The thermal governor, e.g. "step_wise".
+  std::vector<TripPoint> trips;
+};
+
+/// Get the thermal zones of this board, in the order snapshots list them.
+std::vector<ThermalZone> get_thermal_zones();
+
+/// Get the temperature (m°C) of a thermal zone, given its type or domain.
+long int get_zone_temp(const std::string &zone);
+
+/// Get how far (m°C) a thermal zone is below its lowest passive, hot or
+/// critical trip point, given its type or domain. This is negative once the
+/// zone is past the trip point, and throws if the zone has none.
+long int get_thermal_headroom(const std::string &zone);
+
+#ifndef JETSON_CLOCKS_MAX_CPUS
+#define JETSON_CLOCKS_MAX_CPUS 16
+#endif
+
+#ifndef JETSON_CLOCKS_MAX_RAILS
+#define JETSON_CLOCKS_MAX_RAILS 8
+#endif
+
+#ifndef JETSON_CLOCKS_MAX_ZONES
+#define JETSON_CLOCKS_MAX_ZONES 12
+#endif
+
+/// The reading of one thermal zone in a Snapshot.
+struct ZoneSnapshot {
+  char type[24];
+  long int temp_mc;
+  long int headroom_mc; // To the lowest passive, hot or critical trip
+                        // point, or LONG_MAX if the zone has none.
+};
+
+/// The reading of one power rail in a Snapshot.
+struct RailSnapshot {
+  char name[24];
+  long int voltage_mv;
+  long int current_ma;
+  long int power_mw;
+};
+
+/// The clock state of one cpu in a Snapshot.
+struct CpuSnapshot {
+  int cpu_id;
+  long int cur_freq;
+  long int min_freq;
+  long int max_freq;
+  long int effective_freq; // Set by EffectiveFreqMonitor::sample().
+  long int busy_us;        // Time not idle over that sample's interval.
+  char governor[16];
+};
+
+/// The clock state of the whole board, read in one pass.
+/// Values that could not be read are -1, or an empty string.
+struct Snapshot {
+  long long int start_ns; // CLOCK_MONOTONIC before the first read.
+  long long int end_ns;   // CLOCK_MONOTONIC after the last read.
+
+  int num_cpus;
+  CpuSnapshot cpus[JETSON_CLOCKS_MAX_CPUS];
+
+  long int gpu_cur_freq;
+  long int gpu_min_freq;
+  long int gpu_max_freq;
+  int gpu_load;
+
+  long int emc_freq;
+
+  int fan_pwm;
+
+  int num_rails;
+  RailSnapshot rails[JETSON_CLOCKS_MAX_RAILS];
+
+  int num_zones;
+  ZoneSnapshot zones[JETSON_CLOCKS_MAX_ZONES];
+};
+
+/// Read the clock state of the whole board.
+Snapshot snapshot();
+
+/// Read the clock state of the whole board into caller-owned storage.
+/// This does not allocate, so it is suitable for high rate sampling.
+void snapshot(Snapshot &out);
+
+class Attribute;
+
+/// Measures the clock frequency each cpu actually runs at. scaling_cur_freq
+/// (get_cpu_cur_freq()) is the frequency cpufreq asked for; thermal and
+/// over-current throttling can lower the real one without changing it.
+///
+/// Each cpu gets a cycles counter from perf_event_open(), and each sample()
+/// divides the cycles counted since the last one by the time the cpu was
+/// busy, which is the interval less the idle time /proc/stat reports.
+/// Cycles stop while a core idles, so this is the clock it ran at while it
+/// worked, however much of the interval it slept. /proc/stat counts idle
+/// time in clock ticks (usually 10 ms), so sample every 100 ms or more.
+/// Reading is one read() per cpu and one pread() of /proc/stat, and does
+/// not allocate.
+class EffectiveFreqMonitor {
+public:
+  /// Count cycles on every present cpu. Cpus whose counter cannot be opened,
+  /// such as offline ones, read -1. Throws if no counter can be opened, e.g.
+  /// without a hardware PMU or when kernel.perf_event_paranoid forbids it.
+  EffectiveFreqMonitor();
+  explicit EffectiveFreqMonitor(const std::vector<int> &cpu_ids);
+  ~EffectiveFreqMonitor();
+
+  EffectiveFreqMonitor(const EffectiveFreqMonitor &) = delete;
+  EffectiveFreqMonitor &operator=(const EffectiveFreqMonitor &) = delete;
+
+  /// The cpus measured, in the order sample() returns them.
+  const std::vector<int> &cpu_ids() const { return cpu_ids_; }
+
+  /// Get the effective freq of each cpu (kHz) since the previous sample, or
+  /// since construction for the first. A cpu that never left idle reads -1.
+  std::vector<long int> sample();
+
+  /// Set the effective_freq and busy_us of every cpu in a snapshot,
+  /// measured since the previous sample. Cpus that are not measured are
+  /// left at -1.
+  void sample(Snapshot &snap);
+
+  /// Get the time each cpu was not idle (us) over the interval of the last
+  /// sample(), in the same order, or -1 where it is unknown.
+  const std::vector<long int> &busy_us() const { return busy_us_; }
+
+private:
+  void read_counters();
+
+  std::vector<int> cpu_ids_;
+  std::vector<int> fds_;
+  std::vector<unsigned long long int> cycles_;
+  std::vector<unsigned long long int> enabled_ns_;
+  std::vector<unsigned long long int> running_ns_;
+  std::vector<long long int> idle_ns_;
+  std::vector<long int> freqs_;
+  std::vector<long int> busy_us_;
+  Attribute *stat_;                      // /proc/stat
+  std::vector<char> stat_buf_;           // Holds its cpu lines.
+  std::vector<long long int> stat_idle_; // Parsed from stat_buf_.
+  long long int tick_ns_;
+};
+
+/// The SOC families this library knows how to control.
+enum class SocFamily { unknown, tegra210, tegra186, tegra194 };
+
+/// Get the name of a SOC family, e.g. "tegra194".
+const char *get_soc_family_name(SocFamily family);
+
+/// Paths of the clock attributes of one SOC family.
+/// Null entries are attributes the SOC family does not have.
+struct SocPaths {
+  const char *gpu_available_freqs;
+  const char *gpu_min_freq;
+  const char *gpu_max_freq;
+  const char *gpu_cur_freq;
+  const char *gpu_railgate;
+  const char *gpu_load;
+
+  const char *emc_rate;
+  const char *emc_override;
+  const char *emc_min_rate;
+  const char *emc_max_rate;
+  const char *emc_iso_cap;
+  const char *emc_possible_rates; // kHz
+
+  const char *fan_pwm[2]; // Tried in order.
+  const char *qos_enable;
+  const char *cc3_enable[2];
+};
+
+/// Compile-time attribute paths, specialized for each known SOC family.
+template <SocFamily Family> struct SocTraits;
+
+template <> struct SocTraits<SocFamily::unknown> {
+  static constexpr SocPaths paths() {
+    return SocPaths{nullptr,
+                    nullptr,
+                    nullptr,
+                    nullptr,
+                    nullptr,
+                    nullptr,
+                    nullptr,
+                    nullptr,
+                    nullptr,
+                    nullptr,
+                    nullptr,
+                    nullptr,
+                    {"/sys/kernel/debug/tegra_fan/target_pwm",
+                     "/sys/devices/pwm-fan/target_pwm"},
+                    "/sys/module/qos/parameters/enable",
+                    {nullptr, nullptr}};
+  }
+};
+
+template <> struct SocTraits<SocFamily::tegra210> {
+  static constexpr SocPaths paths() {
+    return SocPaths{
+        "/sys/devices/57000000.gpu/devfreq/57000000.gpu/available_frequencies",
+        "/sys/devices/57000000.gpu/devfreq/57000000.gpu/min_freq",
+        "/sys/devices/57000000.gpu/devfreq/57000000.gpu/max_freq",
+        "/sys/devices/57000000.gpu/devfreq/57000000.gpu/cur_freq",
+        "/sys/devices/57000000.gpu/devfreq/57000000.gpu/device/railgate_enable",
+        "/sys/devices/gpu.0/load",
+        "/sys/kernel/debug/clk/override.emc/clk_update_rate",
+        "/sys/kernel/debug/clk/override.emc/clk_state",
+        "/sys/kernel/debug/tegra_bwmgr/emc_min_rate",
+        "/sys/kernel/debug/tegra_bwmgr/emc_max_rate",
+        nullptr,
+        "/sys/kernel/debug/clk/emc/possible_rates",
+        {"/sys/kernel/debug/tegra_fan/target_pwm",
+         "/sys/devices/pwm-fan/target_pwm"},
+        "/sys/module/qos/parameters/enable",
+        {nullptr, nullptr}};
+  }
+};
+
+template <> struct SocTraits<SocFamily::tegra186> {
+  static constexpr SocPaths paths() {
+    return SocPaths{
+        "/sys/devices/17000000.gp10b/devfreq/17000000.gp10b/"
+        "available_frequencies",
+        "/sys/devices/17000000.gp10b/devfreq/17000000.gp10b/min_freq",
+        "/sys/devices/17000000.gp10b/devfreq/17000000.gp10b/max_freq",
+        "/sys/devices/17000000.gp10b/devfreq/17000000.gp10b/cur_freq",
+        "/sys/devices/17000000.gp10b/devfreq/17000000.gp10b/device/"
+        "railgate_enable",
+        nullptr,
+        "/sys/kernel/debug/bpmp/debug/clk/emc/rate",
+        "/sys/kernel/debug/bpmp/debug/clk/emc/mrq_rate_locked",
+        "/sys/kernel/debug/bpmp/debug/clk/emc/min_rate",
+        "/sys/kernel/debug/bpmp/debug/clk/emc/max_rate",
+        "/sys/kernel/nvpmodel_emc_cap/emc_iso_cap",
+        "/sys/kernel/debug/bpmp/debug/clk/emc/possible_rates",
+        {"/sys/kernel/debug/tegra_fan/target_pwm",
+         "/sys/devices/pwm-fan/target_pwm"},
+        "/sys/module/qos/parameters/enable",
+        {"/sys/kernel/debug/tegra_cpufreq/M_CLUSTER/cc3/enable",
+         "/sys/kernel/debug/tegra_cpufreq/B_CLUSTER/cc3/enable"}};
+  }
+};
+
+template <> struct SocTraits<SocFamily::tegra194> {
+  static constexpr SocPaths paths() {
+    return SocPaths{
+        "/sys/devices/17000000.gv11b/devfreq/17000000.gv11b/"
+        "available_frequencies",
+        "/sys/devices/17000000.gv11b/devfreq/17000000.gv11b/min_freq",
+        "/sys/devices/17000000.gv11b/devfreq/17000000.gv11b/max_freq",
+        "/sys/devices/17000000.gv11b/devfreq/17000000.gv11b/cur_freq",
+        "/sys/devices/17000000.gv11b/devfreq/17000000.gv11b/device/"
+        "railgate_enable",
+        nullptr,
+        "/sys/kernel/debug/bpmp/debug/clk/emc/rate",
+        "/sys/kernel/debug/bpmp/debug/clk/emc/mrq_rate_locked",
+        "/sys/kernel/debug/bpmp/debug/clk/emc/min_rate",
+        "/sys/kernel/debug/bpmp/debug/clk/emc/max_rate",
+        "/sys/kernel/nvpmodel_emc_cap/emc_iso_cap",
+        "/sys/kernel/debug/bpmp/debug/clk/emc/possible_rates",
+        {"/sys/kernel/debug/tegra_fan/target_pwm",
+         "/sys/devices/pwm-fan/target_pwm"},
+        "/sys/module/qos/parameters/enable",
+        // The AGX has similar files at
+        // /sys/kernel/debug/tegra_cpufreq/CLUSTER[0-3]/cc3/enable. On my
+        // machine, these are all '1', so I am not sure if they should be
+        // disabled.
+        {nullptr, nullptr}};
+  }
+};
+
+/// Get the attribute paths of a SOC family.
+constexpr SocPaths get_soc_paths(SocFamily family) {
+  return family == SocFamily::tegra210
+             ? SocTraits<SocFamily::tegra210>::paths()
+             : family == SocFamily::tegra186
+                   ? SocTraits<SocFamily::tegra186>::paths()
+                   : family == SocFamily::tegra194
+                         ? SocTraits<SocFamily::tegra194>::paths()
+                         : SocTraits<SocFamily::unknown>::paths();
+}
+
+// Define JETSON_CLOCKS_SOC as one of the SocFamily names (e.g.
+// -DJETSON_CLOCKS_SOC=tegra194) to build for a single SOC family. Board
+// detection then skips the SOC lookup and the path table is chosen at
+// compile time.
+#ifdef JETSON_CLOCKS_SOC
+constexpr SocFamily compiled_soc_family = SocFamily::JETSON_CLOCKS_SOC;
+#endif
+
+/// A handle to a single sysfs or debugfs attribute.
+/// The file is opened once and re-read with pread() at offset zero, which
+/// makes the kernel regenerate its contents without another open()/close().
+/// Handles can be shared between threads; the descriptors are opened at
+/// most once and published atomically.
+class Attribute {
+public:
+  explicit Attribute(const std::string &path);
+  ~Attribute();
+
+  Attribute(const Attribute &) = delete;
+  Attribute &operator=(const Attribute &) = delete;
+
+  /// Get the path of this attribute, without the root dir prefix.
+  const std::string &path() const { return path_; }
+
+  /// Check if the attribute can be opened for reading.
+  bool exists();
+
+  /// Get the descriptor used for reading, or -1 if it cannot be opened.
+  int fd();
+
+  /// Read up to size bytes from the start of the attribute.
+  /// Returns the number of bytes read, or -1 and sets errno.
+  long int read(char *buf, std::size_t size);
+
+  /// Read the attribute as an integer.
+  long int read_long();
+
+  /// Read the attribute as a string with newlines removed.
+  std::string read_string();
+
+  /// Check if the attribute can be opened for writing.
+  bool writable();
+
+  /// Write size bytes to the start of the attribute with a single write().
+  /// Returns zero on success, or the errno of the failed open() or write().
+  int write(const char *data, std::size_t size);
+
+  /// Write an integer to the attribute.
+  void write_long(long int value);
+
+  /// Write a string to the attribute.
+  void write_string(const std::string &value);
+
+private:
+  bool open_for_reading();
+  bool open_for_writing();
+
+  std::string path_;
+  std::atomic<int> fd_;
+  std::atomic<int> write_fd_;
+  std::atomic<bool> truncate_; // Writes must truncate, as for plain files
+                               // in a root dir.
+};
+
+/// Get the cached attribute handle for a given path.
+Attribute &attribute(const std::string &path);
+
+/// The cpufreq attributes of a single cpu.
+struct CpuAttributes {
+  Attribute *available_freqs = nullptr;
+  Attribute *available_governors = nullptr;
+  Attribute *governor = nullptr;
+  Attribute *min_freq = nullptr;
+  Attribute *max_freq = nullptr;
+  Attribute *cur_freq = nullptr;
+};
+
+/// The capability tables of one cpufreq policy, which never change after
+/// boot.
+struct CpufreqTables {
+  std::vector<long int> freqs;
+  std::vector<std::string> governors;        // Sorted, for lookups.
+  std::vector<std::string> kernel_governors; // As the kernel lists them.
+};
+
+/// A device whose clock is scaled by devfreq, found under /sys/class/devfreq.
+struct DevfreqDevice {
+  std::string name; // e.g. "17000000.gv11b"
+  Attribute *available_freqs = nullptr;
+  Attribute *min_freq = nullptr;
+  Attribute *max_freq = nullptr;
+  Attribute *cur_freq = nullptr;
+  std::vector<long int> freq_table;
+};
+
+/// The attributes of one power rail. The hwmon driver has no power
+/// attribute, so power is then computed from voltage and current.
+struct PowerRailAttributes {
+  Attribute *voltage = nullptr; // mV
+  Attribute *current = nullptr; // mA
+  Attribute *power = nullptr;   // mW
+};
+
+/// Everything about this board that only needs to be detected once: the SOC
+/// family, machine model, cpus, the resolved attribute of every clock this
+/// library controls, and the sorted tables of what each clock accepts.
+/// Attributes are null, and tables empty, if the board lacks them.
+struct Platform {
+  SocFamily family = SocFamily::unknown;
+  std::string soc_family;
+  std::string machine;
+  std::vector<int> possible_cpu_ids;
+  std::vector<int> present_cpu_ids;
+  std::vector<CpuAttributes> cpus; // Indexed by cpu id.
+  Attribute *cpu_online = nullptr;
+  std::vector<CpuCluster> clusters;
+  std::vector<CpuAttributes> policies;       // Parallel to clusters.
+  std::vector<CpufreqTables> cluster_tables; // Parallel to clusters.
+  std::vector<int> cpu_clusters; // Index into clusters by cpu id, or -1.
+
+  bool fan_always_on = false;
+  Attribute *fan_pwm = nullptr;
+
+  std::vector<DevfreqDevice> devfreq_devices;
+
+  Attribute *gpu_available_freqs = nullptr;
+  Attribute *gpu_min_freq = nullptr;
+  Attribute *gpu_max_freq = nullptr;
+  Attribute *gpu_cur_freq = nullptr;
+  Attribute *gpu_railgate = nullptr;
+  Attribute *gpu_load = nullptr;
+  std::vector<long int> gpu_freq_table;
+
+  Attribute *emc_rate = nullptr;
+  Attribute *emc_override = nullptr;
+  Attribute *emc_min_rate = nullptr;
+  Attribute *emc_max_rate = nullptr;
+  Attribute *emc_iso_cap = nullptr;
+  Attribute *emc_possible_rates = nullptr;
+  std::vector<long int> emc_freq_table;
+
+  Attribute *qos_enable = nullptr;
+  std::vector<Attribute *> cc3_enable;
+
+  std::vector<PowerRail> power_rails;
+  std::vector<PowerRailAttributes> power_rail_attrs; // Parallel to
+                                                     // power_rails.
+
+  std::vector<ThermalZone> thermal_zones;
+  std::vector<Attribute *> thermal_zone_temps; // Parallel to thermal_zones.
+  std::vector<long int> thermal_zone_trips;    // Parallel to thermal_zones:
+                                               // the lowest passive, hot or
+                                               // critical trip, or LONG_MAX.
+};
+
+/// Get the description of this board, detecting it on first use.
+const Platform &get_platform();
+
+/// How a ReadBatch reads its attributes.
+enum class ReadBackend {
+  pread,   // One pread() per attribute.
+  io_uring // One io_uring submission for the whole batch.
+};
+
+/// A fixed set of attributes that are always read together, each into its
+/// own buffer. The io_uring backend registers the attribute descriptors and
+/// buffers with the kernel once, then submits every read of a batch with a
+/// single io_uring_enter(). It requires JETSON_CLOCKS_USE_IO_URING and a 5.1+
+/// kernel; otherwise the batch quietly falls back to pread().
+class ReadBatch {
+public:
+  ReadBatch(const std::vector<Attribute *> &attrs, ReadBackend backend,
+            std::size_t buf_size = 64);
+  ~ReadBatch();
+
+  ReadBatch(const ReadBatch &) = delete;
+  ReadBatch &operator=(const ReadBatch &) = delete;
+
+  /// Read every attribute in the batch.
+  void read_all();
+
+  /// Get the backend actually in use.
+  ReadBackend backend() const { return backend_; }
+
+  /// Get the number of attributes in the batch.
+  std::size_t size() const { return attrs_.size(); }
+
+  /// Get the buffer of attribute i. It has room for a terminator after the
+  /// bytes that were read.
+  char *data(std::size_t i) { return &buffers_[i * buf_size_]; }
+
+  /// Get the number of bytes read from attribute i, or -1 on failure.
+  long int result(std::size_t i) const { return results_[i]; }
+
+private:
+  bool setup_io_uring();
+  void teardown_io_uring();
+  bool read_all_io_uring();
+
+  std::vector<Attribute *> attrs_;
+  ReadBackend backend_;
+  std::size_t buf_size_;
+  std::vector<char> buffers_;
+  std::vector<long int> results_;
+
+  // io_uring state, unused by the pread backend.
+  std::vector<int> file_index_; // Registered file slot, or -1 if unopened.
+  std::size_t num_registered_ = 0;
+  int ring_fd_ = -1;
+  void *sq_ring_ = nullptr;
+  void *cq_ring_ = nullptr;
+  void *sqes_ = nullptr;
+  std::size_t sq_ring_size_ = 0;
+  std::size_t cq_ring_size_ = 0;
+  std::size_t sqes_size_ = 0;
+  unsigned *sq_tail_ = nullptr;
+  unsigned *sq_mask_ = nullptr;
+  unsigned *sq_array_ = nullptr;
+  unsigned *cq_head_ = nullptr;
+  unsigned *cq_tail_ = nullptr;
+  unsigned *cq_mask_ = nullptr;
+  void *cqes_ = nullptr;
+};
+
+/// Choose the backend snapshot() reads with. The default is pread, which is
+/// faster for the few dozen small attributes of a snapshot; io_uring is an
+/// opt-in for kernels where syscalls are expensive. It takes effect on the
+/// next snapshot().
+void set_snapshot_backend(ReadBackend backend);
+
+/// Delivers a callback whenever a watched attribute changes.
+///
+/// Every attribute is first polled, at an interval that starts at
+/// min_interval_ms and doubles up to max_interval_ms while the value stays
+/// the same. Each one is also registered with epoll for POLLPRI. Once its
+/// driver is seen to call sysfs_notify() (as thermal trip points and some
+/// devfreq and cpufreq attributes do), polling stops and it costs nothing
+/// until it changes.
+///
+/// A callback may watch and unwatch attributes, call stop(), or destroy the
+/// Watcher; wait() returns straight after a callback that destroyed it.
+class Watcher {
+public:
+  using Callback =
+      std::function<void(const std::string &path, const std::string &value)>;
+
+  explicit Watcher(int min_interval_ms = 10, int max_interval_ms = 1000);
+  ~Watcher();
+
+  Watcher(const Watcher &) = delete;
+  Watcher &operator=(const Watcher &) = delete;
+
+  /// Watch the attribute at path. The callback receives its new value
+  /// with newlines removed.
+  void watch(const std::string &path, Callback callback);
+
+  /// Stop watching the attribute at path and close its descriptor. No
+  /// callback for it is made after this returns.
+  void unwatch(const std::string &path);
+
+  /// Get the interval (ms) at which the attribute at path is polled now,
+  /// or -1 if its driver notifies changes and it is no longer polled.
+  /// Throws if it is not watched.
+  int poll_interval_ms(const std::string &path) const;
+
+  /// Wait up to timeout_ms (or forever if negative) for changes, and call
+  /// back for each one. Returns the number of callbacks made.
+  int wait(int timeout_ms);
+
+  /// Call back for changes until stop() is called.
+  void run();
+
+  /// Make run() return. Safe to call from any thread or from a callback.
+  void stop();
+
+private:
+  struct Entry {
+    std::string path;
+    Callback callback;
+    int fd;                 // -1 once unwatched.
+    bool notified;          // sysfs_notify() has been seen.
+    int interval_ms;        // Current polling interval.
+    long long int next_ns;  // When to poll next.
+    std::string value;
+  };
+
+  int check(Entry &entry);
+  void remove_unwatched();
+
+  int min_interval_ms_;
+  int max_interval_ms_;
+  int epoll_fd_;
+  int stop_fd_;
+  std::atomic<bool> stopped_;
+  int waiting_;                 // Nested wait()s; entries must not be freed.
+  std::shared_ptr<bool> alive_; // Cleared by the destructor.
+  std::vector<std::unique_ptr<Entry>> entries_;
+};
+
+/// A bounded lock-free queue between exactly one producer thread and one
+/// consumer thread. The capacity is rounded up to a power of two.
+template <typename T> class SpscRing {
+public:
+  explicit SpscRing(std::size_t capacity)
+      : mask_(round_up(capacity) - 1), slots_(mask_ + 1), head_(0),
+        tail_(0) {}
+
+  SpscRing(const SpscRing &) = delete;
+  SpscRing &operator=(const SpscRing &) = delete;
+
+  /// Add an item. Only the producer may call this. Returns false, and
+  /// drops the item, if the ring is full.
+  bool push(const T &item) {
+    std::size_t tail = tail_.load(std::memory_order_relaxed);
+    if (tail - head_.load(std::memory_order_acquire) > mask_) {
+      return false;
+    }
+    slots_[tail & mask_] = item;
+    tail_.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+
+  /// Take the oldest item. Only the consumer may call this. Returns false
+  /// if the ring is empty.
+  bool pop(T &item) {
+    std::size_t head = head_.load(std::memory_order_relaxed);
+    if (head == tail_.load(std::memory_order_acquire)) {
+      return false;
+    }
+    item = slots_[head & mask_];
+    head_.store(head + 1, std::memory_order_release);
+    return true;
+  }
+
+  /// Get the number of items waiting. Exact only on the consumer thread.
+  std::size_t size() const {
+    return tail_.load(std::memory_order_acquire) -
+           head_.load(std::memory_order_acquire);
+  }
+
+  std::size_t capacity() const { return mask_ + 1; }
+
+private:
+  static std::size_t round_up(std::size_t n) {
+    std::size_t size = 1;
+    while (size < n) {
+      size <<= 1;
+    }
+    return size;
+  }
+
+  std::size_t mask_;
+  std::vector<T> slots_;
+  // The indices live on separate cache lines so the producer and consumer
+  // do not invalidate each other's line on every operation.
+  char pad0_[64];
+  std::atomic<std::size_t> head_;
+  char pad1_[64 - sizeof(std::atomic<std::size_t>)];
+  std::atomic<std::size_t> tail_;
+  char pad2_[64 - sizeof(std::atomic<std::size_t>)];
+};
+
+#ifndef JETSON_CLOCKS_MAX_SAMPLE_VALUES
+#define JETSON_CLOCKS_MAX_SAMPLE_VALUES 32
+#endif
+
+/// One tick of a Sampler.
+struct Sample {
+  unsigned long long int tick; // Timer expirations since start, from 1.
+  long long int time_ns;       // CLOCK_MONOTONIC when the reads started.
+  long long int jitter_ns;     // How late the tick woke up.
+  int num_values;
+  long int values[JETSON_CLOCKS_MAX_SAMPLE_VALUES]; // Parallel to
+                                                    // SamplerOptions::paths,
+                                                    // -1 if a read failed.
+};
+
+/// What a Sampler reads and how.
+struct SamplerOptions {
+  std::vector<std::string> paths; // Attributes holding integers.
+  long int period_us = 10000;
+  std::size_t capacity = 1024; // Samples the ring holds before dropping.
+  int cpu = -1;                // Pin the thread to this cpu, if set.
+  int fifo_priority = 0;       // Run as SCHED_FIFO at this priority, if set.
+  ReadBackend backend = ReadBackend::pread;
+};
+
+/// Counters kept by a Sampler since it started.
+struct SamplerStats {
+  unsigned long long int ticks;      // Ticks sampled.
+  unsigned long long int overruns;   // Ticks missed because one ran late.
+  unsigned long long int dropped;    // Samples lost to a full ring.
+  long long int max_jitter_ns;
+  long long int mean_jitter_ns;
+};
+
+/// Reads a fixed set of attributes every period on its own thread.
+///
+/// The thread waits on a CLOCK_MONOTONIC timerfd, so ticks do not drift,
+/// and publishes each Sample into a lock-free ring that the application
+/// drains with pop() without ever blocking the sampler.
+class Sampler {
+public:
+  explicit Sampler(const SamplerOptions &options);
+  ~Sampler();
+
+  Sampler(const Sampler &) = delete;
+  Sampler &operator=(const Sampler &) = delete;
+
+  /// Start sampling. Throws if the thread cannot be pinned or given its
+  /// real-time priority.
+  void start();
+
+  /// Stop sampling and join the thread. Samples already taken can still
+  /// be popped.
+  void stop();
+
+  /// Take the oldest sample. Returns false if there is none. Call from
+  /// one consumer thread only.
+  bool pop(Sample &sample) { return ring_.pop(sample); }
+
+  /// Get the counters. Safe to call from any thread.
+  SamplerStats stats() const;
+
+private:
+  void run(std::promise<int> &started);
+  int set_scheduling() const;
+
+  SamplerOptions options_;
+  std::unique_ptr<ReadBatch> batch_;
+  SpscRing<Sample> ring_;
+  std::thread thread_;
+  int timer_fd_;
+  int stop_fd_;
+  std::atomic<unsigned long long int> ticks_;
+  std::atomic<unsigned long long int> overruns_;
+  std::atomic<unsigned long long int> dropped_;
+  std::atomic<long long int> max_jitter_ns_;
+  std::atomic<long long int> total_jitter_ns_;
+};
+
+/// How measure_energy() samples the power rails.
+struct EnergyOptions {
+  long int period_us = 1000;   // Time between rail readings.
+  std::size_t capacity = 4096; // Readings buffered while one call runs.
+  int cpu = -1;                // Pin the sampling thread to this cpu, if set.
+};
+
+/// The energy drawn through one power rail during measure_energy().
+struct RailEnergy {
+  PowerRail rail;
+  double energy_j;
+  double energy_per_iteration_j;
+  double average_power_mw;
+};
+
+/// What measure_energy() measured.
+struct EnergyReport {
+  int iterations;
+  double wall_time_s;
+  double time_per_iteration_s;
+  std::vector<RailEnergy> rails; // Parallel to get_power_rails().
+  unsigned long long int samples; // Rail readings integrated.
+  unsigned long long int dropped; // Readings lost because a call ran long
+                                  // enough to fill the buffer.
+  ClockProfile clocks; // The clock settings when the run started.
+};
+
+/// Call callable iterations times while a background thread samples every
+/// power rail, and integrate the energy each rail drew over the run.
+///
+/// Readings are integrated with the trapezoid rule, and the rails are also
+/// read directly just before the first call and after the last one, so the
+/// whole run is covered however short it is.
+EnergyReport measure_energy(const std::function<void()> &callable,
+                            int iterations,
+                            const EnergyOptions &options = EnergyOptions());
+
+/// Publishes snapshots of the board into a POSIX shared-memory segment, so
+/// that any number of processes can follow the clocks for the cost of one
+/// set of reads.
+///
+/// The segment holds a ring of the last history snapshots. Each slot is
+/// guarded by a sequence lock, so the publisher never waits on a reader and
+/// readers never block it. Only one thread may publish at a time, either
+/// through publish() or the thread started by start().
+class TelemetryPublisher {
+public:
+  /// Create the segment /name, readable by every user. Throws if another
+  /// publisher that is still running owns it; a segment left behind by one
+  /// that exited without unlinking it is replaced.
+  explicit TelemetryPublisher(const std::string &name,
+                              std::size_t history = 256);
+  /// Stop publishing and unlink the segment. Readers already attached keep
+  /// their mapping, but it no longer changes.
+  ~TelemetryPublisher();
+
+  TelemetryPublisher(const TelemetryPublisher &) = delete;
+  TelemetryPublisher &operator=(const TelemetryPublisher &) = delete;
+
+  /// Take a snapshot and publish it.
+  void publish();
+
+  /// Publish a snapshot taken by the caller.
+  void publish(const Snapshot &snap);
+
+  /// Take and publish a snapshot every period_us on a background thread.
+  void start(long int period_us);
+
+  /// Stop the background thread.
+  void stop();
+
+  /// Get the number of snapshots published so far.
+  unsigned long long int published() const;
+
+private:
+  void run(long int period_us);
+
+  std::string name_;
+  void *map_;
+  std::size_t map_size_;
+  std::thread thread_;
+  int stop_fd_;
+};
+
+/// Attaches read-only to a segment created by a TelemetryPublisher. Readers
+/// need no root permissions and never read sysfs themselves.
+class TelemetryReader {
+public:
+  /// Attach to the segment /name. Throws if it does not exist or was
+  /// published by a build with a different Snapshot layout.
+  explicit TelemetryReader(const std::string &name);
+  ~TelemetryReader();
+
+  TelemetryReader(const TelemetryReader &) = delete;
+  TelemetryReader &operator=(const TelemetryReader &) = delete;
+
+  /// Copy the newest snapshot. Returns false if none has been published,
+  /// or if its slot stays mid-write, as it does when the publisher died
+  /// while writing it. Compare its end_ns with CLOCK_MONOTONIC to tell how
+  /// fresh it is.
+  bool latest(Snapshot &out) const;
+
+  /// Append every snapshot from publication next onwards that is still in
+  /// the ring to out, oldest first, and advance next past them. Returns the
+  /// number appended; publications that were already overwritten are
+  /// skipped.
+  std::size_t read_since(unsigned long long int &next,
+                         std::vector<Snapshot> &out) const;
+
+  /// Get the number of snapshots published so far.
+  unsigned long long int published() const;
+
+  /// Get the number of snapshots the ring holds.
+  std::size_t capacity() const;
+
+private:
+  void *map_;
+  std::size_t map_size_;
+};
+
+/// How a FanController turns temperature into fan speed.
+enum class FanMode {
+  curve, // Interpolate the pwm from a temperature curve.
+  pid    // Hold the temperature at a target with a PID loop.
+};
+
+/// One point of a fan curve.
+struct FanCurvePoint {
+  long int temp_mc; // m°C
+  int pwm;          // 0 to 255
+};
+
+/// What a FanController reads and how it responds.
+struct FanControllerOptions {
+  /// The zones to follow, by type or domain. The hottest one is used. All
+  /// zones are followed if this is empty.
+  std::vector<std::string> zones;
+  FanMode mode = FanMode::curve;
+
+  /// For FanMode::curve, ascending in temperature. Below the first point
+  /// and above the last, the pwm of the nearest end is used.
+  std::vector<FanCurvePoint> curve = {
+      {40000, 0}, {50000, 80}, {60000, 160}, {70000, 255}};
+  /// For FanMode::curve, how far (m°C) the temperature must fall before
+  /// the fan slows down, so it does not hunt around a curve point.
+  long int hysteresis_mc = 2000;
+
+  /// For FanMode::pid, the temperature to hold (m°C), and the gains in pwm
+  /// per °C, per °C second and per °C per second.
+  long int target_mc = 60000;
+  double kp = 8.0;
+  double ki = 0.5;
+  double kd = 0.0;
+
+  int min_pwm = 0;
+  int max_pwm = 255;
+  int max_step = 10;        // The most the pwm may change in one tick.
+  long int period_ms = 1000; // Time between ticks of the background thread.
+};
+
+/// Drives the fan from the thermal zones in this process, either on its own
+/// background thread or from an external event loop that calls tick().
+///
+/// The pwm is written only when it changes, under the same lock as
+/// set_fan_speed(). tick() must not be called while the thread runs.
+class FanController {
+public:
+  explicit FanController(const FanControllerOptions &options);
+  ~FanController();
+
+  FanController(const FanController &) = delete;
+  FanController &operator=(const FanController &) = delete;
+
+  /// Read the zones, update the pwm and write it if it changed. Returns the
+  /// pwm.
+  int tick();
+
+  /// Call tick() every period_ms on a background thread.
+  void start();
+
+  /// Stop the background thread.
+  void stop();
+
+  /// Get the pwm last chosen.
+  int pwm() const { return pwm_; }
+
+  /// Get the number of pwm writes made.
+  unsigned long long int writes() const { return writes_; }
+
+private:
+  int target_pwm(long int temp_mc, long long int now_ns);
+  void run();
+
+  FanControllerOptions options_;
+  std::unique_ptr<ReadBatch> batch_;
+  std::atomic<int> pwm_;
+  std::atomic<unsigned long long int> writes_;
+  long int curve_temp_mc_;  // The temperature the curve is evaluated at.
+  double integral_;
+  double last_error_;
+  long long int last_tick_ns_;
+  std::thread thread_;
+  int stop_fd_;
+};
+
 /// Functions will throw this exception if they cannot fulfill their purpose.
 struct JetsonClocksException : public virtual std::runtime_error {
   explicit JetsonClocksException(const char *message)
@@ -149,66 +1422,135 @@ struct JetsonClocksException : public virtual std::runtime_error {
 //--------------------------------------------------------//
 
 #include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstdint>
 #include <cstdlib>
+#include <cstring>
+#include <ctime>
 #include <dirent.h>
+#include <fcntl.h>
 #include <fstream>
 #include <iostream>
+#include <iterator>
+#include <limits>
+#include <linux/magic.h>
+#include <linux/perf_event.h>
 #include <memory>
-#include <regex>
+#include <mutex>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
 #include <sstream>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/timerfd.h>
 #include <sys/types.h>
+#include <sys/vfs.h>
 #include <unistd.h>
+#include <unordered_map>
+
+#ifdef JETSON_CLOCKS_USE_IO_URING
+#include <linux/io_uring.h>
+#include <sys/uio.h>
+#endif
 
 namespace jetson_clocks {
 
-template <typename T> std::string to_string(T value) {
-  std::ostringstream os;
-  os << value;
-  return os.str();
+/// Format value as decimal digits into buf, which must hold at least 21
+/// chars. Returns the number of chars written. No terminator is added.
+std::size_t format_long(long int value, char *buf) {
+  char digits[20];
+  std::size_t n = 0;
+  unsigned long int magnitude =
+      value < 0 ? 0UL - static_cast<unsigned long int>(value)
+                : static_cast<unsigned long int>(value);
+  do {
+    digits[n++] = static_cast<char>('0' + magnitude % 10);
+    magnitude /= 10;
+  } while (magnitude != 0);
+
+  std::size_t len = 0;
+  if (value < 0) {
+    buf[len++] = '-';
+  }
+  while (n > 0) {
+    buf[len++] = digits[--n];
+  }
+  return len;
+}
+
+std::string to_string(long int value) {
+  char buf[24];
+  return std::string(buf, format_long(value, buf));
 }
 
 bool running_as_root() { return (geteuid() == 0); }
 
-bool file_exists(const std::string &name) {
-  std::ifstream f(name.c_str());
-  return f.good();
+std::string &root_dir_storage() {
+  static std::string dir;
+  return dir;
 }
 
-bool file_writable(const std::string &name) {
-  if (!file_exists(name)) {
-    return false;
-  }
-  FILE *fp = fopen(name.c_str(), "w");
-  return fp != NULL;
+void set_root_dir(const std::string &dir) { root_dir_storage() = dir; }
+
+const std::string &get_root_dir() { return root_dir_storage(); }
+
+std::string resolve_path(const std::string &name) {
+  return root_dir_storage() + name;
+}
+
+bool file_exists(const std::string &name) {
+  return access(resolve_path(name).c_str(), F_OK) == 0;
 }
 
 std::string read_file(const std::string &name) {
-  std::ifstream t(name.c_str());
+  std::ifstream t(resolve_path(name).c_str());
   std::stringstream buffer;
   buffer << t.rdbuf();
   return buffer.str();
 }
 
-bool write_file(const std::string &name, const std::string &str) {
-  if (!file_writable(name)) {
-    return false;
-  }
-  std::ofstream out(name.c_str());
-  out << str;
-  return true;
-}
-
 std::string strip_newline(const std::string &input) {
   std::string output = input;
   output.erase(std::remove(output.begin(), output.end(), '\n'), output.end());
   return output;
 }
 
+std::vector<long int> parse_longs(const std::string &str) {
+  std::vector<long int> values;
+  const char *p = str.c_str();
+  for (;;) {
+    char *end = nullptr;
+    long int value = std::strtol(p, &end, 10);
+    if (end == p) {
+      break;
+    }
+    values.push_back(value);
+    p = end;
+  }
+  return values;
+}
+
+std::vector<std::string> parse_words(const std::string &str) {
+  std::vector<std::string> words;
+  std::size_t begin = str.find_first_not_of(" \t\n");
+  while (begin != std::string::npos) {
+    std::size_t end = str.find_first_of(" \t\n", begin);
+    words.push_back(str.substr(begin, end - begin));
+    begin = str.find_first_not_of(" \t\n", end);
+  }
+  return words;
+}
+
 std::vector<std::string> list_subdirs(const std::string &path) {
   int dir_count = 0;
   struct dirent *dent;
-  DIR *srcdir = opendir(path.c_str());
+  DIR *srcdir = opendir(resolve_path(path).c_str());
 
   std::vector<std::string> dirs;
 
@@ -234,606 +1576,1445 @@ std::vector<std::string> list_subdirs(const std::string &path) {
   return dirs;
 }
 
-std::string get_soc_family() {
-  std::string soc_family = "";
-  if (file_exists("/sys/devices/soc0/family")) {
-    soc_family = read_file("/sys/devices/soc0/family");
-  } else if (file_exists("/proc/device-tree/compatible")) {
-    std::string compat_file = read_file("/proc/device-tree/compatible");
-    if (compat_file.find("nvidia,tegra210") != std::string::npos) { // Nano
-      soc_family = "tegra210";
-    } else if (compat_file.find("nvidia,tegra186") != std::string::npos) {
-      soc_family = "tegra186";
-    } else if (compat_file.find("nvidia,tegra194") != std::string::npos) {
-      soc_family = "tegra194";
-    }
-  } else {
-    throw JetsonClocksException("SOC family cannot be found.");
+Attribute::Attribute(const std::string &path)
+    : path_(path), fd_(-1), write_fd_(-1), truncate_(false) {}
+
+Attribute::~Attribute() {
+  if (fd_ >= 0) {
+    close(fd_);
+  }
+  if (write_fd_ >= 0) {
+    close(write_fd_);
   }
-  return soc_family;
 }
 
-std::string get_machine() {
-  std::string machine = "";
-  if (file_exists("/sys/devices/soc0/family")) {
-    if (file_exists("/sys/devices/soc0/machine")) {
-      machine = read_file("/sys/devices/soc0/machine");
-    }
-  } else if (file_exists("/proc/device-tree/model")) {
-    machine = read_file("/proc/device-tree/model");
-  } else {
-    throw JetsonClocksException("machine type cannot be found.");
+// Publish a newly opened descriptor, unless another thread got there first.
+void publish_fd(std::atomic<int> &slot, int fd) {
+  int expected = -1;
+  if (!slot.compare_exchange_strong(expected, fd)) {
+    close(fd);
   }
-  return machine;
 }
 
-void set_fan_speed(unsigned char speed) {
-  if (!running_as_root()) {
-    throw JetsonClocksException(
-        "fan speed can not be set without root permissions.");
+bool Attribute::open_for_reading() {
+  if (fd_ >= 0) {
+    return true;
   }
-
-  // Jetson-TK1 CPU fan is always ON.
-  if (get_machine() == "jetson-tk1") {
-    return;
+  int fd = open(resolve_path(path_).c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return false;
   }
+  publish_fd(fd_, fd);
+  return true;
+}
 
-  std::string path = "";
+bool Attribute::exists() { return open_for_reading(); }
 
-  if (file_writable("/sys/kernel/debug/tegra_fan/target_pwm")) {
-    path = "/sys/kernel/debug/tegra_fan/target_pwm";
-  } else if (file_writable("/sys/devices/pwm-fan/target_pwm")) {
-    path = "/sys/devices/pwm-fan/target_pwm";
-  } else {
-    throw JetsonClocksException("fan speed file not found.");
-  }
+int Attribute::fd() { return open_for_reading() ? fd_.load() : -1; }
 
-  std::string speed_string = to_string(static_cast<int>(speed));
-  write_file(path, speed_string);
+long int Attribute::read(char *buf, std::size_t size) {
+  if (!open_for_reading()) {
+    return -1;
+  }
+  ssize_t n;
+  do {
+    n = pread(fd_, buf, size, 0);
+  } while (n < 0 && errno == EINTR);
+  return n;
 }
 
-unsigned char get_fan_speed() {
-  if (!running_as_root()) {
-    throw JetsonClocksException(
-        "fan speed cannot be read without root permissions.");
+long int Attribute::read_long() {
+  char buf[64];
+  long int n = read(buf, sizeof(buf) - 1);
+  if (n < 0) {
+    throw JetsonClocksException("cannot read " + path_ + ": " +
+                                std::strerror(errno));
   }
+  buf[n] = '\0';
 
-  // Jetson-TK1 CPU fan is always ON.
-  if (get_machine() == "jetson-tk1") {
-    return 255;
+  char *end = nullptr;
+  errno = 0;
+  long int value = std::strtol(buf, &end, 10);
+  if (end == buf || errno != 0) {
+    throw JetsonClocksException("cannot parse an integer from " + path_ + ".");
   }
+  return value;
+}
 
-  std::string path = "";
-
-  if (file_writable("/sys/kernel/debug/tegra_fan/target_pwm")) {
-    path = "/sys/kernel/debug/tegra_fan/target_pwm";
-  } else if (file_writable("/sys/devices/pwm-fan/target_pwm")) {
-    path = "/sys/devices/pwm-fan/target_pwm";
-  } else {
-    throw JetsonClocksException("fan speed file not found.");
+std::string Attribute::read_string() {
+  // sysfs attributes are at most one page, but debugfs files can be larger.
+  char buf[4096];
+  std::string output;
+  off_t offset = 0;
+  for (;;) {
+    if (!open_for_reading()) {
+      throw JetsonClocksException("cannot read " + path_ + ": " +
+                                  std::strerror(errno));
+    }
+    ssize_t n = pread(fd_, buf, sizeof(buf), offset);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n < 0) {
+      throw JetsonClocksException("cannot read " + path_ + ": " +
+                                  std::strerror(errno));
+    }
+    output.append(buf, n);
+    offset += n;
+    if (static_cast<std::size_t>(n) < sizeof(buf)) {
+      break;
+    }
   }
-
-  return std::stoi(read_file(path));
+  return strip_newline(output);
 }
 
-std::vector<long int> get_gpu_available_freqs() {
-  if (!running_as_root()) {
-    throw JetsonClocksException(
-        "cannot read gpu available freqs without root permissions.");
+bool Attribute::open_for_writing() {
+  // Read-only sysfs attributes refuse O_RDWR even for root, so writes use
+  // their own descriptor.
+  if (write_fd_ >= 0) {
+    return true;
   }
-
-  std::string soc_family = get_soc_family();
-
-  std::string GPU_AVAILABLE_FREQS = "";
-
-  if (soc_family == "tegra186") {
-    GPU_AVAILABLE_FREQS = "/sys/devices/17000000.gp10b/devfreq/17000000.gp10b/"
-                          "available_frequencies";
-  } else if (soc_family == "tegra210") {
-    GPU_AVAILABLE_FREQS =
-        "/sys/devices/57000000.gpu/devfreq/57000000.gpu/available_frequencies";
-  } else if (soc_family == "tegra194") {
-    GPU_AVAILABLE_FREQS = "/sys/devices/17000000.gv11b/devfreq/17000000.gv11b/"
-                          "available_frequencies";
-  }else {
-    throw JetsonClocksException(
-        "cannot read gpu available freqs with unsupported SOC family " +
-        soc_family + ".");
+  int fd = open(resolve_path(path_).c_str(), O_WRONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return false;
   }
+  // A write to a kernel attribute replaces its value, but one to an
+  // ordinary file (e.g. a fake tree under set_root_dir()) has to be
+  // truncated to do the same.
+  struct statfs fs;
+  truncate_ = fstatfs(fd, &fs) == 0 && fs.f_type != SYSFS_MAGIC &&
+              fs.f_type != DEBUGFS_MAGIC && fs.f_type != PROC_SUPER_MAGIC;
+  publish_fd(write_fd_, fd);
+  return true;
+}
 
-  std::string speedstr = read_file(GPU_AVAILABLE_FREQS);
-  std::istringstream iss(speedstr);
+bool Attribute::writable() { return open_for_writing(); }
 
-  long int s;
-  std::vector<long int> speeds;
-  while (iss >> s) {
-    speeds.push_back(s);
+int Attribute::write(const char *data, std::size_t size) {
+  if (!open_for_writing()) {
+    return errno;
+  }
+  ssize_t n;
+  do {
+    n = pwrite(write_fd_, data, size, 0);
+  } while (n < 0 && errno == EINTR);
+  if (n >= 0 && truncate_ && ftruncate(write_fd_, n) != 0) {
+    return errno;
+  }
+  if (n < 0) {
+    return errno;
   }
+  return static_cast<std::size_t>(n) == size ? 0 : EIO;
+}
 
-  std::sort(speeds.begin(), speeds.end(), std::less<long int>());
-  return speeds;
+void Attribute::write_long(long int value) {
+  char buf[24];
+  int err = write(buf, format_long(value, buf));
+  if (err != 0) {
+    throw JetsonClocksException("cannot write " + to_string(value) + " to " +
+                                path_ + ": " + std::strerror(err));
+  }
 }
 
-void set_gpu_freq_range(long int min_freq, long int max_freq) {
-  if (!running_as_root()) {
-    throw JetsonClocksException(
-        "cannot set gpu freq range without root permissions.");
+void Attribute::write_string(const std::string &value) {
+  int err = write(value.data(), value.size());
+  if (err != 0) {
+    throw JetsonClocksException("cannot write " + value + " to " + path_ +
+                                ": " + std::strerror(err));
   }
+}
 
-  std::vector<long int> available_freqs = get_gpu_available_freqs();
+Attribute &attribute(const std::string &path) {
+  // Handles are never removed, so references stay valid after unlocking.
+  static std::mutex mutex;
+  static std::unordered_map<std::string, std::unique_ptr<Attribute>> cache;
+  std::lock_guard<std::mutex> lock(mutex);
+  std::unique_ptr<Attribute> &attr = cache[path];
+  if (!attr) {
+    attr.reset(new Attribute(path));
+  }
+  return *attr;
+}
 
-  // Min freq must be available.
-  if (std::find(available_freqs.begin(), available_freqs.end(), min_freq) ==
-      available_freqs.end()) {
-    throw JetsonClocksException(
-        "selected gpu minimum frequency is not available.");
+// Read an attribute without throwing. Returns an empty string on failure.
+std::string read_current(Attribute &attr) {
+  char buf[256];
+  long int n = attr.read(buf, sizeof(buf) - 1);
+  if (n < 0) {
+    return std::string();
   }
+  return strip_newline(std::string(buf, n));
+}
 
-  // Max freq must be available.
-  if (std::find(available_freqs.begin(), available_freqs.end(), max_freq) ==
-      available_freqs.end()) {
-    throw JetsonClocksException(
-        "selected gpu maximum frequency is not available.");
+// Parse an attribute value read by read_current(), or return fallback.
+long int parse_current(const std::string &value, long int fallback) {
+  char *end = nullptr;
+  errno = 0;
+  long int result = std::strtol(value.c_str(), &end, 10);
+  if (end == value.c_str() || errno != 0) {
+    return fallback;
   }
+  return result;
+}
 
-  std::string soc_family = get_soc_family();
-
-  std::string GPU_MIN_FREQ = "";
-  std::string GPU_MAX_FREQ = "";
-  std::string GPU_CUR_FREQ = "";
-  std::string GPU_RAIL_GATE = "";
-
-  if (soc_family == "tegra186") {
-    GPU_MIN_FREQ =
-        "/sys/devices/17000000.gp10b/devfreq/17000000.gp10b/min_freq";
-    GPU_MAX_FREQ =
-        "/sys/devices/17000000.gp10b/devfreq/17000000.gp10b/max_freq";
-    GPU_RAIL_GATE = "/sys/devices/17000000.gp10b/devfreq/17000000.gp10b/device/"
-                    "railgate_enable";
-  } else if (soc_family == "tegra210") {
-    GPU_MIN_FREQ = "/sys/devices/57000000.gpu/devfreq/57000000.gpu/min_freq";
-    GPU_MAX_FREQ = "/sys/devices/57000000.gpu/devfreq/57000000.gpu/max_freq";
-    GPU_RAIL_GATE =
-        "/sys/devices/57000000.gpu/devfreq/57000000.gpu/device/railgate_enable";
-  } else if (soc_family == "tegra194") {
-    GPU_MIN_FREQ =
-        "/sys/devices/17000000.gv11b/devfreq/17000000.gv11b/min_freq";
-    GPU_MAX_FREQ =
-        "/sys/devices/17000000.gv11b/devfreq/17000000.gv11b/max_freq";
-    GPU_RAIL_GATE = "/sys/devices/17000000.gv11b/devfreq/17000000.gv11b/device/"
-                    "railgate_enable";
-  } else {
-    throw JetsonClocksException(
-        "cannot gpu frequency range with unsupported SOC family " + soc_family +
-        ".");
+long int read_current_long(Attribute *attr, long int fallback) {
+  return attr ? parse_current(read_current(*attr), fallback) : fallback;
+}
+
+const char *get_soc_family_name(SocFamily family) {
+  switch (family) {
+  case SocFamily::tegra210:
+    return "tegra210";
+  case SocFamily::tegra186:
+    return "tegra186";
+  case SocFamily::tegra194:
+    return "tegra194";
+  default:
+    return "";
   }
+}
 
-  write_file(GPU_MIN_FREQ, to_string(min_freq));
-  write_file(GPU_MAX_FREQ, to_string(max_freq));
-  write_file(GPU_RAIL_GATE, "0");
+SocFamily parse_soc_family(const std::string &str) {
+  if (str.find("tegra210") != std::string::npos) { // Nano
+    return SocFamily::tegra210;
+  } else if (str.find("tegra186") != std::string::npos) {
+    return SocFamily::tegra186;
+  } else if (str.find("tegra194") != std::string::npos) {
+    return SocFamily::tegra194;
+  }
+  return SocFamily::unknown;
 }
 
-long int get_gpu_cur_freq() {
-  if (!running_as_root()) {
-    throw JetsonClocksException(
-        "cannot get gpu current freq. without root permissions.");
+std::string detect_soc_family() {
+  std::string soc_family = "";
+  if (file_exists("/sys/devices/soc0/family")) {
+    soc_family = attribute("/sys/devices/soc0/family").read_string();
+  }
+  if (parse_soc_family(soc_family) != SocFamily::unknown) {
+    return soc_family;
   }
 
-  std::string soc_family = get_soc_family();
+  // Newer kernels report just "Tegra" in soc0/family.
+  std::string compat = "";
+  if (file_exists("/proc/device-tree/compatible")) {
+    compat = read_file("/proc/device-tree/compatible");
+    SocFamily family = parse_soc_family(compat);
+    if (family != SocFamily::unknown) {
+      return get_soc_family_name(family);
+    }
+  }
 
-  std::string PATH = "";
+  // Name what was found. The compatible strings are NUL separated.
+  std::replace(compat.begin(), compat.end(), '\0', ' ');
+  std::string found = "";
+  for (const std::string &name : parse_words(soc_family + " " + compat)) {
+    found += (found.empty() ? "" : ", ") + name;
+  }
+  if (found.empty()) {
+    found = "no soc0/family or device tree compatible";
+  }
+  throw JetsonClocksException(
+      "unsupported SOC family (" + found +
+      "). Define JETSON_CLOCKS_SOC as tegra210, tegra186 or tegra194 to "
+      "use one anyway.");
+}
 
-  if (soc_family == "tegra186") { // TODO
-    PATH = "";
-  } else if (soc_family == "tegra210") { // TODO
-    PATH = "";
-  } else if (soc_family == "tegra194") {
-    PATH = "/sys/devices/17000000.gv11b/devfreq/17000000.gv11b/cur_freq";
+std::string detect_machine() {
+  std::string machine = "";
+  if (file_exists("/sys/devices/soc0/family")) {
+    if (file_exists("/sys/devices/soc0/machine")) {
+      machine = read_file("/sys/devices/soc0/machine");
+    }
+  } else if (file_exists("/proc/device-tree/model")) {
+    machine = read_file("/proc/device-tree/model");
   } else {
-    throw JetsonClocksException(
-        "cannot get current gpu frequency with unsupported SOC family " + soc_family +
-        ".");
+    throw JetsonClocksException("machine type cannot be found.");
   }
+  // The device tree model is NUL terminated, soc0/machine ends in a newline.
+  while (!machine.empty() &&
+         (machine.back() == '\n' || machine.back() == '\0')) {
+    machine.pop_back();
+  }
+  return machine;
+}
 
-  if (!file_exists(PATH)) {
-    throw JetsonClocksException("cannot get current gpu freq. because " + PATH +
-                                " does not exist.");
+std::vector<int> parse_cpu_list(const char *str) {
+  std::vector<int> ids;
+  const char *p = str;
+  while (*p != '\0') {
+    if (*p < '0' || *p > '9') {
+      ++p; // Separator or trailing newline.
+      continue;
+    }
+    int first = 0;
+    while (*p >= '0' && *p <= '9') {
+      first = first * 10 + (*p++ - '0');
+    }
+    int last = first;
+    if (*p == '-') {
+      ++p;
+      last = 0;
+      while (*p >= '0' && *p <= '9') {
+        last = last * 10 + (*p++ - '0');
+      }
+    }
+    for (int id = first; id <= last; ++id) {
+      ids.push_back(id);
+    }
   }
+  return ids;
+}
 
-  long int cur_freq = std::stoi(read_file(PATH));
+std::vector<int> read_cpu_list(const std::string &path) {
+  if (!file_exists(path)) {
+    return std::vector<int>();
+  }
+  return parse_cpu_list(attribute(path).read_string().c_str());
+}
 
-  return cur_freq;
+CpuAttributes make_cpufreq_attributes(const std::string &dir) {
+  CpuAttributes cpu;
+  cpu.available_freqs = &attribute(dir + "scaling_available_frequencies");
+  cpu.available_governors = &attribute(dir + "scaling_available_governors");
+  cpu.governor = &attribute(dir + "scaling_governor");
+  cpu.min_freq = &attribute(dir + "scaling_min_freq");
+  cpu.max_freq = &attribute(dir + "scaling_max_freq");
+  cpu.cur_freq = &attribute(dir + "scaling_cur_freq");
+  return cpu;
 }
 
-long int get_gpu_min_freq() {
-  if (!running_as_root()) {
-    throw JetsonClocksException(
-        "cannot get gpu min freq. without root permissions.");
+std::string detect_core_name(int cpu_id) {
+  std::string path = "/sys/devices/system/cpu/cpu" + to_string(cpu_id) +
+                     "/regs/identification/midr_el1";
+  if (!file_exists(path)) {
+    return "";
   }
+  unsigned long int midr =
+      std::strtoul(attribute(path).read_string().c_str(), nullptr, 16);
+  unsigned long int implementer = (midr >> 24) & 0xff;
+  unsigned long int part = (midr >> 4) & 0xfff;
+
+  if (implementer == 0x41) { // ARM
+    switch (part) {
+    case 0xd03:
+      return "Cortex-A53";
+    case 0xd07:
+      return "Cortex-A57";
+    case 0xd42:
+      return "Cortex-A78AE";
+    }
+  } else if (implementer == 0x4e) { // NVIDIA
+    switch (part) {
+    case 0x003:
+      return "Denver";
+    case 0x004:
+      return "Carmel";
+    }
+  }
+  return "";
+}
 
-  std::string soc_family = get_soc_family();
-
-  std::string PATH = "";
+void detect_clusters(Platform &p) {
+  // Each cluster is one cpufreq policy, found through the related_cpus of
+  // its cpus. Older kernels have no policyN directories, so fall back to
+  // the per-cpu cpufreq directory of the first cpu in the cluster.
+  for (int cpu_id : p.possible_cpu_ids) {
+    bool seen = false;
+    for (const CpuCluster &cluster : p.clusters) {
+      seen = seen || std::find(cluster.cpu_ids.begin(), cluster.cpu_ids.end(),
+                               cpu_id) != cluster.cpu_ids.end();
+    }
+    std::string related = "/sys/devices/system/cpu/cpu" + to_string(cpu_id) +
+                          "/cpufreq/related_cpus";
+    if (seen || !file_exists(related)) {
+      continue;
+    }
 
-  if (soc_family == "tegra186") { // TODO
-    PATH = "";
-  } else if (soc_family == "tegra210") { // TODO
-    PATH = "";
-  } else if (soc_family == "tegra194") {
-    PATH = "/sys/devices/17000000.gv11b/devfreq/17000000.gv11b/min_freq";
-  } else {
-    throw JetsonClocksException(
-        "cannot get gpu min frequency with unsupported SOC family " + soc_family +
-        ".");
-  }
+    CpuCluster cluster;
+    cluster.cpu_ids = parse_cpu_list(attribute(related).read_string().c_str());
+    if (cluster.cpu_ids.empty()) {
+      continue;
+    }
+    cluster.policy_id = cluster.cpu_ids.front();
+    cluster.name = detect_core_name(cpu_id);
 
-  if (!file_exists(PATH)) {
-    throw JetsonClocksException("cannot get min gpu freq. because " + PATH +
-                                " does not exist.");
+    std::string dir = "/sys/devices/system/cpu/cpufreq/policy" +
+                      to_string(cluster.policy_id) + "/";
+    if (!file_exists(dir)) {
+      dir = "/sys/devices/system/cpu/cpu" + to_string(cpu_id) + "/cpufreq/";
+    }
+    p.clusters.push_back(cluster);
+    p.policies.push_back(make_cpufreq_attributes(dir));
   }
+}
 
-  long int min_freq = std::stoi(read_file(PATH));
-
-  return min_freq;
+template <typename T> std::vector<T> sorted(std::vector<T> values) {
+  std::sort(values.begin(), values.end());
+  values.erase(std::unique(values.begin(), values.end()), values.end());
+  return values;
 }
 
-long int get_gpu_max_freq() {
-  if (!running_as_root()) {
-    throw JetsonClocksException(
-        "cannot get gpu max freq. without root permissions.");
+/// Read a table of numbers, or nothing if the attribute cannot be read.
+std::vector<long int> load_long_table(Attribute *attr) {
+  if (!attr || !attr->exists()) {
+    return std::vector<long int>();
+  }
+  try {
+    return sorted(parse_longs(attr->read_string()));
+  } catch (JetsonClocksException &) {
+    return std::vector<long int>();
   }
+}
 
-  std::string soc_family = get_soc_family();
+void load_tables(Platform &p) {
+  p.cpu_clusters.assign(p.cpus.size(), -1);
+  for (std::size_t i = 0; i < p.clusters.size(); ++i) {
+    for (int cpu_id : p.clusters[i].cpu_ids) {
+      if (cpu_id < static_cast<int>(p.cpu_clusters.size())) {
+        p.cpu_clusters[cpu_id] = static_cast<int>(i);
+      }
+    }
 
-  std::string PATH = "";
+    CpufreqTables tables;
+    tables.freqs = load_long_table(p.policies[i].available_freqs);
+    Attribute *governors = p.policies[i].available_governors;
+    if (governors->exists()) {
+      try {
+        tables.kernel_governors = parse_words(governors->read_string());
+        tables.governors = sorted(tables.kernel_governors);
+      } catch (JetsonClocksException &) {
+      }
+    }
+    p.cluster_tables.push_back(tables);
+  }
 
-  if (soc_family == "tegra186") { // TODO
-    PATH = "";
-  } else if (soc_family == "tegra210") { // TODO
-    PATH = "";
-  } else if (soc_family == "tegra194") {
-    PATH = "/sys/devices/17000000.gv11b/devfreq/17000000.gv11b/max_freq";
-  } else {
-    throw JetsonClocksException(
-        "cannot get gpu max frequency with unsupported SOC family " + soc_family +
-        ".");
+  p.gpu_freq_table = load_long_table(p.gpu_available_freqs);
+  for (DevfreqDevice &device : p.devfreq_devices) {
+    device.freq_table = load_long_table(device.available_freqs);
   }
 
-  if (!file_exists(PATH)) {
-    throw JetsonClocksException("cannot get max gpu freq. because " + PATH +
-                                " does not exist.");
+  std::vector<long int> emc_min = load_long_table(p.emc_min_rate);
+  std::vector<long int> emc_max = load_long_table(p.emc_max_rate);
+  if (emc_min.empty() || emc_max.empty()) {
+    return;
+  }
+  // The clock framework lists the EMC DVFS table in kHz, ending in "(kHz)".
+  // Rates outside [min_rate, max_rate] are fused off or reserved.
+  for (long int rate : load_long_table(p.emc_possible_rates)) {
+    rate *= 1000;
+    if (rate >= emc_min[0] && rate <= emc_max[0]) {
+      p.emc_freq_table.push_back(rate);
+    }
+  }
+  if (p.emc_freq_table.empty()) {
+    p.emc_possible_rates = nullptr;
+    p.emc_freq_table = sorted(std::vector<long int>{emc_min[0], emc_max[0]});
   }
+}
 
-  long int max_freq = std::stoi(read_file(PATH));
+Attribute *attribute_or_null(const char *path) {
+  return path ? &attribute(path) : nullptr;
+}
 
-  return max_freq;
+Attribute *optional_attribute(const std::string &path) {
+  Attribute &attr = attribute(path);
+  return attr.exists() ? &attr : nullptr;
 }
 
-int get_gpu_current_usage() {
-  std::string soc_family = get_soc_family();
+/// What each board calls its power rails, and the domain they supply.
+struct RailDomain {
+  const char *name;
+  const char *domain;
+};
 
-  std::string GPU_USAGE = "";
-  if (soc_family == "tegra210") {
-    GPU_USAGE = "/sys/devices/gpu.0/load";
-  } else {
-    throw JetsonClocksException("cannot get current GPU usage. SOC family unsupported.");
+constexpr RailDomain rail_domains[] = {
+    // Nano
+    {"POM_5V_IN", "VDD_IN"},
+    {"POM_5V_GPU", "VDD_GPU"},
+    {"POM_5V_CPU", "VDD_CPU"},
+    // TX2
+    {"VDD_IN", "VDD_IN"},
+    {"VDD_SYS_GPU", "VDD_GPU"},
+    {"VDD_SYS_CPU", "VDD_CPU"},
+    {"VDD_SYS_SOC", "VDD_SOC"},
+    {"VDD_SYS_DDR", "VDD_DDR"},
+    // AGX Xavier
+    {"GPU", "VDD_GPU"},
+    {"CPU", "VDD_CPU"},
+    {"SOC", "VDD_SOC"},
+    {"CV", "VDD_CV"},
+    {"VDDRQ", "VDD_DDR"},
+    {"SYS5V", "VDD_IN"},
+    // Xavier NX, Orin NX and Orin Nano
+    {"VDD_CPU_GPU_CV", "VDD_CPU_GPU_CV"},
+    {"VDD_SOC", "VDD_SOC"},
+    // AGX Orin
+    {"VDD_GPU_SOC", "VDD_GPU_SOC"},
+    {"VDD_CPU_CV", "VDD_CPU_CV"},
+    {"VIN_SYS_5V0", "VDD_IN"},
+    {"VDDQ_VDD2_1V8AO", "VDD_DDR"}};
+
+std::string rail_domain(const std::string &name) {
+  for (const RailDomain &rail : rail_domains) {
+    if (name == rail.name) {
+      return rail.domain;
+    }
   }
+  return "";
+}
 
-  return std::stoi(read_file(GPU_USAGE));
+std::string read_label(const std::string &path) {
+  return file_exists(path) ? attribute(path).read_string() : "";
 }
 
-std::vector<long int> get_emc_available_freqs() {
-  if (!running_as_root()) {
-    throw JetsonClocksException(
-        "cannot read EMC available freqs without root permissions.");
+void add_power_rail(Platform &p, const std::string &name,
+                    const PowerRailAttributes &attrs) {
+  // Unconnected channels are labelled NC.
+  if (name.empty() || name == "NC" || !attrs.voltage || !attrs.current) {
+    return;
   }
+  p.power_rails.push_back(PowerRail{name, rail_domain(name)});
+  p.power_rail_attrs.push_back(attrs);
+}
 
-  std::string soc_family = get_soc_family();
-
-  std::string EMC_ISO_CAP = "";
-  std::string EMC_MIN_FREQ = "";
-  std::string EMC_MAX_FREQ = "";
+/// What each SOC calls its thermal zones, and the sensor they read.
+struct ZoneDomain {
+  const char *type;
+  const char *domain;
+};
 
-  if (soc_family == "tegra186" || soc_family == "tegra194") {
-    EMC_ISO_CAP = "/sys/kernel/nvpmodel_emc_cap/emc_iso_cap";
-    EMC_MIN_FREQ = "/sys/kernel/debug/bpmp/debug/clk/emc/min_rate";
-    EMC_MAX_FREQ = "/sys/kernel/debug/bpmp/debug/clk/emc/max_rate";
+constexpr ZoneDomain zone_domains[] = {
+    // Nano, TX2 and Xavier
+    {"CPU-therm", "CPU"},
+    {"GPU-therm", "GPU"},
+    {"AUX-therm", "AUX"},
+    {"PLL-therm", "PLL"},
+    {"AO-therm", "AO"},
+    {"Tboard_tegra", "Tboard"},
+    {"Tdiode_tegra", "Tdiode"},
+    {"PMIC-Die", "PMIC"},
+    {"thermal-fan-est", "fan-est"},
+    // Orin
+    {"cpu-thermal", "CPU"},
+    {"gpu-thermal", "GPU"},
+    {"cv0-thermal", "CV0"},
+    {"cv1-thermal", "CV1"},
+    {"cv2-thermal", "CV2"},
+    {"soc0-thermal", "SOC0"},
+    {"soc1-thermal", "SOC1"},
+    {"soc2-thermal", "SOC2"},
+    {"tj-thermal", "Tj"}};
+
+std::string zone_domain(const std::string &type) {
+  for (const ZoneDomain &zone : zone_domains) {
+    if (type == zone.type) {
+      return zone.domain;
+    }
+  }
+  return "";
+}
 
-    long int emc_cap = std::stoi(read_file(EMC_ISO_CAP));
-    long int emc_fmax = std::stoi(read_file(EMC_MAX_FREQ));
-    if (emc_cap > 0 && emc_cap < emc_fmax) {
-      EMC_MAX_FREQ = EMC_ISO_CAP;
+/// Get the lowest trip point of a zone that throttles or shuts down, or
+/// LONG_MAX if it has none. Active trip points only turn the fan up.
+long int throttle_trip(const ThermalZone &zone) {
+  long int trip_mc = std::numeric_limits<long int>::max();
+  for (const TripPoint &trip : zone.trips) {
+    if (trip.type != "active") {
+      trip_mc = std::min(trip_mc, trip.temp_mc);
     }
-  } else if (soc_family == "tegra210") {
-    EMC_MIN_FREQ = "/sys/kernel/debug/tegra_bwmgr/emc_min_rate";
-    EMC_MAX_FREQ = "/sys/kernel/debug/tegra_bwmgr/emc_max_rate";
-  } else {
-    throw JetsonClocksException(
-        "cannot get emc available frequencies. SOC family unsupported.");
   }
+  return trip_mc;
+}
 
-  long int min_freq = std::stoi(read_file(EMC_MIN_FREQ));
-  long int max_freq = std::stoi(read_file(EMC_MAX_FREQ));
-  return {min_freq, max_freq};
+void detect_thermal_zones(Platform &p) {
+  const std::string thermal = "/sys/class/thermal/";
+  std::vector<int> zone_ids;
+  for (const std::string &dir : list_subdirs(thermal)) {
+    if (dir.compare(0, 12, "thermal_zone") == 0) {
+      zone_ids.push_back(std::atoi(dir.c_str() + 12));
+    }
+  }
+  for (int zone_id : sorted(zone_ids)) {
+    std::string dir = thermal + "thermal_zone" + to_string(zone_id) + "/";
+    Attribute *temp = optional_attribute(dir + "temp");
+    if (!temp) {
+      continue;
+    }
+    ThermalZone zone;
+    zone.zone_id = zone_id;
+    zone.type = read_label(dir + "type");
+    zone.domain = zone_domain(zone.type);
+    zone.policy = read_label(dir + "policy");
+    for (int trip = 0;; ++trip) {
+      std::string prefix = dir + "trip_point_" + to_string(trip);
+      Attribute *trip_temp = optional_attribute(prefix + "_temp");
+      if (!trip_temp) {
+        break;
+      }
+      zone.trips.push_back(TripPoint{read_current_long(trip_temp, 0),
+                                     read_label(prefix + "_type")});
+    }
+    p.thermal_zones.push_back(zone);
+    p.thermal_zone_temps.push_back(temp);
+    p.thermal_zone_trips.push_back(throttle_trip(zone));
+  }
 }
 
-long int get_emc_freq() {
-  if (!running_as_root()) {
-    throw JetsonClocksException(
-        "cannot read EMC freq without root permissions.");
+void detect_power_rails(Platform &p) {
+  // L4T 32 kernels expose each INA3221 as an iio device, which reports
+  // power itself.
+  const std::string iio_driver = "/sys/bus/i2c/drivers/ina3221x/";
+  for (const std::string &device : sorted(list_subdirs(iio_driver))) {
+    for (const std::string &iio : sorted(list_subdirs(iio_driver + device))) {
+      if (iio.compare(0, 10, "iio:device") != 0) {
+        continue;
+      }
+      std::string dir = iio_driver + device + "/" + iio + "/";
+      for (int channel = 0; channel < 3; ++channel) {
+        std::string n = to_string(channel);
+        std::string name = read_label(dir + "rail_name_" + n);
+        PowerRailAttributes attrs;
+        attrs.voltage = optional_attribute(dir + "in_voltage" + n + "_input");
+        attrs.current = optional_attribute(dir + "in_current" + n + "_input");
+        attrs.power = optional_attribute(dir + "in_power" + n + "_input");
+        add_power_rail(p, name, attrs);
+      }
+    }
   }
 
-  std::string soc_family = get_soc_family();
+  // Later kernels use the mainline hwmon driver, with channels from 1.
+  const std::string hwmon_driver = "/sys/bus/i2c/drivers/ina3221/";
+  for (const std::string &device : sorted(list_subdirs(hwmon_driver))) {
+    std::string hwmon_dir = hwmon_driver + device + "/hwmon/";
+    for (const std::string &hwmon : sorted(list_subdirs(hwmon_dir))) {
+      std::string dir = hwmon_dir + hwmon + "/";
+      for (int channel = 1; channel <= 3; ++channel) {
+        std::string n = to_string(channel);
+        std::string name = read_label(dir + "in" + n + "_label");
+        PowerRailAttributes attrs;
+        attrs.voltage = optional_attribute(dir + "in" + n + "_input");
+        attrs.current = optional_attribute(dir + "curr" + n + "_input");
+        add_power_rail(p, name, attrs);
+      }
+    }
+  }
+}
 
-  std::string EMC_UPDATE_FREQ = "";
-  std::string EMC_FREQ_OVERRIDE = "";
+// Suffixes of the devfreq device names the GPU has had: 57000000.gpu on
+// tegra210, 17000000.gp10b on tegra186, 17000000.gv11b on tegra194 and
+// 17000000.ga10b on tegra234.
+constexpr const char *gpu_devfreq_names[] = {"gpu", "gp10b", "gv11b",
+                                             "ga10b"};
+
+bool is_gpu_devfreq(const std::string &name) {
+  std::string::size_type dot = name.rfind('.');
+  std::string suffix = dot == std::string::npos ? name : name.substr(dot + 1);
+  for (const char *gpu : gpu_devfreq_names) {
+    if (suffix == gpu) {
+      return true;
+    }
+  }
+  return false;
+}
 
-  if (soc_family == "tegra186" | soc_family == "tagra194") {
-    EMC_UPDATE_FREQ = "/sys/kernel/debug/bpmp/debug/clk/emc/rate";
-    EMC_FREQ_OVERRIDE = "/sys/kernel/debug/bpmp/debug/clk/emc/mrq_rate_locked";
-  } else if (soc_family == "tegra210") {
-    EMC_UPDATE_FREQ = "/sys/kernel/debug/clk/override.emc/clk_update_rate";
-    EMC_FREQ_OVERRIDE = "/sys/kernel/debug/clk/override.emc/clk_state";
-  } else {
-    throw JetsonClocksException(
-        "cannot get emc frequency. SOC family unsupported.");
+// Every devfreq device links into /sys/class/devfreq under the same name on
+// every SOC, so this finds the GPU even where SocTraits has no paths for it.
+void detect_devfreq_devices(Platform &p) {
+  const std::string devfreq = "/sys/class/devfreq/";
+  for (const std::string &name : sorted(list_subdirs(devfreq))) {
+    std::string dir = devfreq + name + "/";
+    DevfreqDevice device;
+    device.name = name;
+    device.available_freqs = optional_attribute(dir + "available_frequencies");
+    device.min_freq = optional_attribute(dir + "min_freq");
+    device.max_freq = optional_attribute(dir + "max_freq");
+    device.cur_freq = optional_attribute(dir + "cur_freq");
+    if (!device.min_freq || !device.max_freq) {
+      continue;
+    }
+    p.devfreq_devices.push_back(device);
+
+    if (!p.gpu_available_freqs && is_gpu_devfreq(name)) {
+      p.gpu_available_freqs = device.available_freqs;
+      p.gpu_min_freq = device.min_freq;
+      p.gpu_max_freq = device.max_freq;
+      p.gpu_cur_freq = device.cur_freq;
+      p.gpu_railgate = optional_attribute(dir + "device/railgate_enable");
+      p.gpu_load = optional_attribute(dir + "device/load");
+    }
   }
+}
 
-  return std::stoi(read_file(EMC_UPDATE_FREQ));
+// Later kernels drive the fan with the mainline pwm-fan driver, which only
+// has a hwmon pwm1 attribute.
+Attribute *detect_hwmon_fan() {
+  const std::string hwmon = "/sys/class/hwmon/";
+  for (const std::string &dir : sorted(list_subdirs(hwmon))) {
+    std::string name = read_label(hwmon + dir + "/name");
+    if (name == "pwmfan" || name == "pwm-fan") {
+      Attribute *pwm = optional_attribute(hwmon + dir + "/pwm1");
+      if (pwm) {
+        return pwm;
+      }
+    }
+  }
+  return nullptr;
 }
 
-void set_emc_freq(long int freq) {
-  if (!running_as_root()) {
-    throw JetsonClocksException(
-        "cannot set EMC freq without root permissions.");
+Platform detect_platform() {
+  Platform p;
+#ifdef JETSON_CLOCKS_SOC
+  p.family = compiled_soc_family;
+  p.soc_family = get_soc_family_name(compiled_soc_family);
+  constexpr SocPaths paths = SocTraits<compiled_soc_family>::paths();
+#else
+  p.soc_family = detect_soc_family();
+  p.family = parse_soc_family(p.soc_family);
+  const SocPaths paths = get_soc_paths(p.family);
+#endif
+  p.machine = detect_machine();
+  p.possible_cpu_ids = read_cpu_list("/sys/devices/system/cpu/possible");
+  p.present_cpu_ids = read_cpu_list("/sys/devices/system/cpu/present");
+  if (p.present_cpu_ids.empty()) {
+    p.present_cpu_ids = p.possible_cpu_ids;
   }
+  if (p.possible_cpu_ids.empty()) {
+    p.possible_cpu_ids = p.present_cpu_ids;
+  }
+  p.cpu_online = optional_attribute("/sys/devices/system/cpu/online");
 
-  auto emc_freqs = get_emc_available_freqs();
-  long int min_freq = emc_freqs[0];
-  long int max_freq = emc_freqs[emc_freqs.size() - 1];
-  if (freq < min_freq || freq > max_freq) {
-    throw JetsonClocksException("emc frequency not in acceptable range.");
+  // Attributes exist for every possible cpu so that cpus brought online
+  // later can be used without detecting the platform again.
+  if (!p.possible_cpu_ids.empty()) {
+    p.cpus.resize(p.possible_cpu_ids.back() + 1);
   }
+  for (int cpu_id : p.possible_cpu_ids) {
+    p.cpus[cpu_id] = make_cpufreq_attributes(
+        "/sys/devices/system/cpu/cpu" + to_string(cpu_id) + "/cpufreq/");
+  }
+  detect_clusters(p);
 
-  std::string soc_family = get_soc_family();
+  // Jetson-TK1 CPU fan is always ON.
+  p.fan_always_on = (p.machine == "jetson-tk1");
+  for (const char *fan_pwm : paths.fan_pwm) {
+    if (!p.fan_pwm && fan_pwm) {
+      p.fan_pwm = optional_attribute(fan_pwm);
+    }
+  }
+  if (!p.fan_pwm) {
+    p.fan_pwm = detect_hwmon_fan();
+  }
 
-  std::string EMC_UPDATE_FREQ = "";
-  std::string EMC_FREQ_OVERRIDE = "";
+  // The GPU is found through /sys/class/devfreq first; the SocTraits paths
+  // remain for kernels without the class links.
+  detect_devfreq_devices(p);
+  if (!p.gpu_available_freqs) {
+    p.gpu_available_freqs = attribute_or_null(paths.gpu_available_freqs);
+    p.gpu_min_freq = attribute_or_null(paths.gpu_min_freq);
+    p.gpu_max_freq = attribute_or_null(paths.gpu_max_freq);
+    p.gpu_cur_freq = attribute_or_null(paths.gpu_cur_freq);
+    p.gpu_railgate = attribute_or_null(paths.gpu_railgate);
+  }
+  if (!p.gpu_load) {
+    p.gpu_load = attribute_or_null(paths.gpu_load);
+  }
 
-  if (soc_family == "tegra186" || soc_family == "tegra194") {
-    EMC_UPDATE_FREQ = "/sys/kernel/debug/bpmp/debug/clk/emc/rate";
-    EMC_FREQ_OVERRIDE = "/sys/kernel/debug/bpmp/debug/clk/emc/mrq_rate_locked";
-  } else if (soc_family == "tegra210") {
-    EMC_UPDATE_FREQ = "/sys/kernel/debug/clk/override.emc/clk_update_rate";
-    EMC_FREQ_OVERRIDE = "/sys/kernel/debug/clk/override.emc/clk_state";
-  } else {
-    throw JetsonClocksException(
-        "cannot set emc frequency with unsupported soc_family" + soc_family +
-        ".");
+  p.emc_rate = attribute_or_null(paths.emc_rate);
+  p.emc_override = attribute_or_null(paths.emc_override);
+  p.emc_min_rate = attribute_or_null(paths.emc_min_rate);
+  p.emc_max_rate = attribute_or_null(paths.emc_max_rate);
+  p.emc_iso_cap = attribute_or_null(paths.emc_iso_cap);
+  p.emc_possible_rates = attribute_or_null(paths.emc_possible_rates);
+
+  p.qos_enable = attribute_or_null(paths.qos_enable);
+  for (const char *cc3 : paths.cc3_enable) {
+    if (cc3) {
+      p.cc3_enable.push_back(&attribute(cc3));
+    }
   }
+  detect_power_rails(p);
+  detect_thermal_zones(p);
 
-  write_file(EMC_UPDATE_FREQ, to_string(freq));
-  write_file(EMC_FREQ_OVERRIDE, "1");
+  load_tables(p);
+  return p;
 }
 
-std::vector<int> get_cpu_ids() {
+const Platform &get_platform() {
+  static const Platform platform = detect_platform();
+  return platform;
+}
+
+// Writers of a clock domain hold its lock, so slow writes to one domain
+// never wait on another. Readers take no locks. Code that holds several
+// takes them in the order they are declared here.
+struct DomainLocks {
+  explicit DomainLocks(std::size_t num_policies) : policies(num_policies) {}
+
+  std::vector<std::mutex> policies; // Parallel to Platform::clusters.
+  std::mutex gpu;
+  std::mutex emc;
+  std::mutex fan;
+  std::mutex qos; // Also covers cc3.
+};
+
+DomainLocks &get_domain_locks() {
+  static DomainLocks locks(get_platform().clusters.size());
+  return locks;
+}
+
+std::string get_soc_family() { return get_platform().soc_family; }
+
+std::string get_machine() { return get_platform().machine; }
+
+void set_fan_speed(unsigned char speed) {
   if (!running_as_root()) {
     throw JetsonClocksException(
-        "cannot look up CPU ids without root permissions.");
+        "fan speed can not be set without root permissions.");
   }
 
-  // Find all directories in /sys/devices/system/cpu/ ending in cpu[0-9].
-  std::vector<std::string> cpu_subdirs;
-  {
-    std::vector<std::string> all_subdirs =
-        list_subdirs("/sys/devices/system/cpu/");
-
-    std::regex reg("(.*)cpu[0-9]");
-    std::copy_if(
-        all_subdirs.begin(), all_subdirs.end(), std::back_inserter(cpu_subdirs),
-        [&reg](const std::string &str) { return std::regex_match(str, reg); });
+  const Platform &platform = get_platform();
+  if (platform.fan_always_on) {
+    return;
   }
-
-  std::vector<int> ids;
-  for (const auto &dir : cpu_subdirs) {
-    ids.push_back(dir[dir.size() - 1] - '0');
+  if (!platform.fan_pwm) {
+    throw JetsonClocksException("fan speed file not found.");
   }
-  std::sort(ids.begin(), ids.end(), std::less<int>());
-  return ids;
+
+  std::lock_guard<std::mutex> lock(get_domain_locks().fan);
+  platform.fan_pwm->write_long(speed);
 }
 
-std::vector<long int> get_cpu_available_freqs(int cpu_id) {
+unsigned char get_fan_speed() {
   if (!running_as_root()) {
     throw JetsonClocksException(
-        "cannot look up CPU available frequencies without root permissions.");
+        "fan speed cannot be read without root permissions.");
   }
 
-  std::string path = "/sys/devices/system/cpu/cpu" + to_string(cpu_id) +
-                     "/cpufreq/scaling_available_frequencies";
+  const Platform &platform = get_platform();
+  if (platform.fan_always_on) {
+    return 255;
+  }
+  if (!platform.fan_pwm) {
+    throw JetsonClocksException("fan speed file not found.");
+  }
 
-  if (!file_exists(path)) {
+  return platform.fan_pwm->read_long();
+}
+
+Span<long int> get_gpu_freq_table() {
+  if (!running_as_root()) {
     throw JetsonClocksException(
-        "cannot get cpu available frequencies because " + path +
-        " does not exist.");
+        "cannot read gpu available freqs without root permissions.");
   }
 
-  std::string speedstr = read_file(path);
-  std::istringstream iss(speedstr);
-
-  long int s;
-  std::vector<long int> speeds;
-  while (iss >> s) {
-    speeds.push_back(s);
+  const Platform &platform = get_platform();
+  if (!platform.gpu_available_freqs) {
+    throw JetsonClocksException(
+        "cannot read gpu available freqs with unsupported SOC family " +
+        platform.soc_family + ".");
+  }
+  if (platform.gpu_freq_table.empty()) {
+    throw JetsonClocksException("cannot read gpu available freqs from " +
+                                platform.gpu_available_freqs->path() + ".");
   }
 
-  std::sort(speeds.begin(), speeds.end(), std::less<long int>());
-  return speeds;
+  return platform.gpu_freq_table;
 }
 
-std::vector<std::string> get_cpu_available_governors(int cpu_id) {
+std::vector<long int> get_gpu_available_freqs() {
+  return get_gpu_freq_table().to_vector();
+}
+
+void set_gpu_freq_range(long int min_freq, long int max_freq) {
   if (!running_as_root()) {
     throw JetsonClocksException(
-        "cannot look up CPU available governors without root permissions.");
+        "cannot set gpu freq range without root permissions.");
   }
 
-  std::string path = "/sys/devices/system/cpu/cpu" + to_string(cpu_id) +
-                     "/cpufreq/scaling_available_governors";
+  Span<long int> available_freqs = get_gpu_freq_table();
 
-  if (!file_exists(path)) {
+  // Min freq must be available.
+  if (!available_freqs.contains(min_freq)) {
     throw JetsonClocksException(
-        "cannot look up CPU available governors because " + path +
-        " does not exist.");
+        "selected gpu minimum frequency is not available.");
   }
 
-  std::string govstr = strip_newline(read_file(path));
+  // Max freq must be available.
+  if (!available_freqs.contains(max_freq)) {
+    throw JetsonClocksException(
+        "selected gpu maximum frequency is not available.");
+  }
 
-  std::istringstream iss(govstr);
-  std::vector<std::string> governors((std::istream_iterator<std::string>(iss)),
-                                     std::istream_iterator<std::string>());
-  return governors;
+  const Platform &platform = get_platform();
+  std::lock_guard<std::mutex> lock(get_domain_locks().gpu);
+  platform.gpu_min_freq->write_long(min_freq);
+  platform.gpu_max_freq->write_long(max_freq);
+  if (platform.gpu_railgate) {
+    platform.gpu_railgate->write_long(0);
+  }
 }
 
-std::string get_cpu_governor(int cpu_id) {
+long int get_gpu_cur_freq() {
   if (!running_as_root()) {
     throw JetsonClocksException(
-        "cannot get cpu governor without root permissions.");
+        "cannot get gpu current freq. without root permissions.");
   }
 
-  std::string path = "/sys/devices/system/cpu/cpu" + to_string(cpu_id) +
-                     "/cpufreq/scaling_governor";
+  const Platform &platform = get_platform();
+  if (!platform.gpu_cur_freq) {
+    throw JetsonClocksException(
+        "cannot get current gpu frequency with unsupported SOC family " +
+        platform.soc_family + ".");
+  }
 
-  if (!file_exists(path)) {
-    throw JetsonClocksException("cannot get cpu governor because " + path +
+  if (!platform.gpu_cur_freq->exists()) {
+    throw JetsonClocksException("cannot get current gpu freq. because " +
+                                platform.gpu_cur_freq->path() +
                                 " does not exist.");
   }
 
-  std::string governor = strip_newline(read_file(path));
-  return governor;
+  return platform.gpu_cur_freq->read_long();
 }
 
-long int get_cpu_min_freq(int cpu_id) {
+long int get_gpu_min_freq() {
   if (!running_as_root()) {
     throw JetsonClocksException(
-        "cannot get cpu min. freq. without root permissions.");
+        "cannot get gpu min freq. without root permissions.");
   }
 
-  std::string path = "/sys/devices/system/cpu/cpu" + to_string(cpu_id) +
-                     "/cpufreq/scaling_min_freq";
+  const Platform &platform = get_platform();
+  if (!platform.gpu_min_freq) {
+    throw JetsonClocksException(
+        "cannot get gpu min frequency with unsupported SOC family " +
+        platform.soc_family + ".");
+  }
 
-  if (!file_exists(path)) {
-    throw JetsonClocksException("cannot get min. freq. because " + path +
+  if (!platform.gpu_min_freq->exists()) {
+    throw JetsonClocksException("cannot get min gpu freq. because " +
+                                platform.gpu_min_freq->path() +
                                 " does not exist.");
   }
 
-  long int min_freq = std::stoi(read_file(path));
-
-  return min_freq;
+  return platform.gpu_min_freq->read_long();
 }
 
-long int get_cpu_max_freq(int cpu_id) {
+long int get_gpu_max_freq() {
   if (!running_as_root()) {
     throw JetsonClocksException(
-        "cannot get cpu max. freq. without root permissions.");
+        "cannot get gpu max freq. without root permissions.");
   }
 
-  std::string path = "/sys/devices/system/cpu/cpu" + to_string(cpu_id) +
-                     "/cpufreq/scaling_max_freq";
+  const Platform &platform = get_platform();
+  if (!platform.gpu_max_freq) {
+    throw JetsonClocksException(
+        "cannot get gpu max frequency with unsupported SOC family " +
+        platform.soc_family + ".");
+  }
 
-  if (!file_exists(path)) {
-    throw JetsonClocksException("cannot get max. freq. because " + path +
+  if (!platform.gpu_max_freq->exists()) {
+    throw JetsonClocksException("cannot get max gpu freq. because " +
+                                platform.gpu_max_freq->path() +
                                 " does not exist.");
   }
 
-  long int max_freq = std::stoi(read_file(path));
+  return platform.gpu_max_freq->read_long();
+}
+
+long int get_gpu_min_speed() { return get_gpu_min_freq(); }
+
+long int get_gpu_max_speed() { return get_gpu_max_freq(); }
+
+int get_gpu_current_usage() {
+  const Platform &platform = get_platform();
+  if (!platform.gpu_load) {
+    throw JetsonClocksException(
+        "cannot get current GPU usage. SOC family unsupported.");
+  }
 
-  return max_freq;
+  return platform.gpu_load->read_long();
 }
 
-long int get_cpu_cur_freq(int cpu_id) {
+std::vector<std::string> get_devfreq_devices() {
+  std::vector<std::string> names;
+  for (const DevfreqDevice &device : get_platform().devfreq_devices) {
+    names.push_back(device.name);
+  }
+  return names;
+}
+
+const DevfreqDevice &get_devfreq_device(const std::string &name) {
+  for (const DevfreqDevice &device : get_platform().devfreq_devices) {
+    if (device.name == name) {
+      return device;
+    }
+  }
+  throw JetsonClocksException("devfreq device " + name + " not found.");
+}
+
+long int read_devfreq_freq(const std::string &name, Attribute *attr,
+                           const char *what) {
+  if (!attr) {
+    throw JetsonClocksException("cannot get " + std::string(what) +
+                                " freq. of devfreq device " + name + ".");
+  }
+  return attr->read_long();
+}
+
+Span<long int> get_devfreq_freq_table(const std::string &name) {
+  const DevfreqDevice &device = get_devfreq_device(name);
+  if (device.freq_table.empty()) {
+    throw JetsonClocksException("cannot read available freqs of devfreq "
+                                "device " +
+                                name + ".");
+  }
+  return device.freq_table;
+}
+
+long int get_devfreq_cur_freq(const std::string &name) {
+  return read_devfreq_freq(name, get_devfreq_device(name).cur_freq,
+                           "current");
+}
+
+long int get_devfreq_min_freq(const std::string &name) {
+  return read_devfreq_freq(name, get_devfreq_device(name).min_freq, "min");
+}
+
+long int get_devfreq_max_freq(const std::string &name) {
+  return read_devfreq_freq(name, get_devfreq_device(name).max_freq, "max");
+}
+
+Span<long int> get_emc_freq_table() {
   if (!running_as_root()) {
     throw JetsonClocksException(
-        "cannot get cpu current freq. without root permissions.");
+        "cannot read EMC available freqs without root permissions.");
   }
 
-  std::string path = "/sys/devices/system/cpu/cpu" + to_string(cpu_id) +
-                     "/cpufreq/scaling_cur_freq";
+  const Platform &platform = get_platform();
+  if (!platform.emc_min_rate) {
+    throw JetsonClocksException(
+        "cannot get emc available frequencies. SOC family unsupported.");
+  }
+  if (platform.emc_freq_table.empty()) {
+    throw JetsonClocksException("cannot read emc frequency limits from " +
+                                platform.emc_max_rate->path() + ".");
+  }
 
-  if (!file_exists(path)) {
-    throw JetsonClocksException("cannot get current cpu freq. because " + path +
-                                " does not exist.");
+  return platform.emc_freq_table;
+}
+
+std::vector<long int> get_emc_available_freqs() {
+  Span<long int> table = get_emc_freq_table();
+
+  const Platform &platform = get_platform();
+  long int emc_cap = platform.emc_iso_cap ? platform.emc_iso_cap->read_long()
+                                          : 0;
+  if (emc_cap <= 0 || emc_cap >= table.back()) {
+    return table.to_vector();
+  }
+
+  // Without the DVFS table only the limits are known, so the cap is taken
+  // as the new maximum. With it, the cap keeps the operating points below.
+  if (!platform.emc_possible_rates) {
+    return {table.front(), std::max(table.front(), emc_cap)};
+  }
+  std::vector<long int> freqs;
+  for (long int freq : table) {
+    if (freq <= emc_cap || freqs.empty()) {
+      freqs.push_back(freq);
+    }
+  }
+  return freqs;
+}
+
+long int get_emc_freq() {
+  if (!running_as_root()) {
+    throw JetsonClocksException(
+        "cannot read EMC freq without root permissions.");
   }
 
-  long int cur_freq = std::stoi(read_file(path));
+  const Platform &platform = get_platform();
+  if (!platform.emc_rate) {
+    throw JetsonClocksException(
+        "cannot get emc frequency. SOC family unsupported.");
+  }
 
-  return cur_freq;
+  return platform.emc_rate->read_long();
 }
 
-void set_cpu_min_freq(int cpu_id, long int min_freq) {
+void set_emc_freq(long int freq) {
   if (!running_as_root()) {
     throw JetsonClocksException(
-        "cannot set CPU min. freq. without root permissions.");
+        "cannot set EMC freq without root permissions.");
   }
 
-  std::string path = "/sys/devices/system/cpu/cpu" + to_string(cpu_id) +
-                     "/cpufreq/scaling_min_freq";
-  if (!file_writable(path)) {
-    throw JetsonClocksException("cannot set cpu" + to_string(cpu_id) +
-                                " min. freq. because " + path +
-                                " is not writable.");
+  auto emc_freqs = get_emc_available_freqs();
+  long int min_freq = emc_freqs[0];
+  long int max_freq = emc_freqs[emc_freqs.size() - 1];
+  if (freq < min_freq || freq > max_freq) {
+    throw JetsonClocksException("emc frequency not in acceptable range.");
+  }
+  // The BPMP rounds requests up to the next operating point; do it here so
+  // the written rate is the one that will be read back.
+  freq = snap_freq(emc_freqs, freq, Rounding::ceil);
+
+  const Platform &platform = get_platform();
+  std::lock_guard<std::mutex> lock(get_domain_locks().emc);
+  platform.emc_rate->write_long(freq);
+  platform.emc_override->write_long(1);
+}
+
+// Bandwidth table layout: a version line, then one line per operating point
+// of "emc_freq copy_gbps scale_gbps triad_gbps power_mw". Other lines that
+// start with '#' are comments.
+const char *const emc_bandwidth_header = "# jetson_clocks emc bandwidth 1";
+
+void save_emc_bandwidth_table(const std::string &path,
+                              const std::vector<EmcBandwidth> &table) {
+  std::ofstream out(path.c_str(), std::ios::trunc);
+  out << emc_bandwidth_header << "\n"
+      << "# emc_freq_hz copy_gbps scale_gbps triad_gbps power_mw\n";
+  for (const EmcBandwidth &row : table) {
+    out << row.emc_freq << " " << row.copy_gbps << " " << row.scale_gbps
+        << " " << row.triad_gbps << " " << row.power_mw << "\n";
   }
+  out.close();
+  if (!out) {
+    throw JetsonClocksException("cannot save emc bandwidth table to " + path +
+                                ".");
+  }
+}
 
-  auto available_freqs = get_cpu_available_freqs(cpu_id);
+std::vector<EmcBandwidth> load_emc_bandwidth_table(const std::string &path) {
+  std::ifstream in(path.c_str());
+  std::string line;
+  if (!in || !std::getline(in, line) || line != emc_bandwidth_header) {
+    throw JetsonClocksException("cannot read emc bandwidth table " + path +
+                                ".");
+  }
 
-  if (std::find(available_freqs.begin(), available_freqs.end(), min_freq) ==
-      available_freqs.end()) {
-    throw JetsonClocksException(to_string(min_freq) +
-                                " is not an available min. freq.");
+  std::vector<EmcBandwidth> table;
+  while (std::getline(in, line)) {
+    if (line.empty() || line[0] == '#') {
+      continue;
+    }
+    std::istringstream fields(line);
+    EmcBandwidth row;
+    if (!(fields >> row.emc_freq >> row.copy_gbps >> row.scale_gbps >>
+          row.triad_gbps >> row.power_mw)) {
+      throw JetsonClocksException("malformed line in emc bandwidth table " +
+                                  path + ": " + line);
+    }
+    table.push_back(row);
+  }
+  std::sort(table.begin(), table.end(),
+            [](const EmcBandwidth &a, const EmcBandwidth &b) {
+              return a.emc_freq < b.emc_freq;
+            });
+  return table;
+}
+
+long int pick_emc_freq(const std::vector<EmcBandwidth> &table, double gbps) {
+  if (table.empty()) {
+    throw JetsonClocksException("cannot pick from an empty bandwidth table.");
+  }
+  const EmcBandwidth *lowest = nullptr;
+  const EmcBandwidth *fastest = &table[0];
+  for (const EmcBandwidth &row : table) {
+    if (row.triad_gbps >= gbps &&
+        (!lowest || row.emc_freq < lowest->emc_freq)) {
+      lowest = &row;
+    }
+    if (row.triad_gbps > fastest->triad_gbps) {
+      fastest = &row;
+    }
   }
+  return (lowest ? lowest : fastest)->emc_freq;
+}
 
-  write_file("/sys/module/qos/parameters/enable", "0");
+std::vector<int> get_cpu_ids() {
+  if (!running_as_root()) {
+    throw JetsonClocksException(
+        "cannot look up CPU ids without root permissions.");
+  }
 
-  if (get_soc_family() == "tegra186") {
-    write_file("/sys/kernel/debug/tegra_cpufreq/M_CLUSTER/cc3/enable", "0");
-    write_file("/sys/kernel/debug/tegra_cpufreq/B_CLUSTER/cc3/enable", "0");
+  const Platform &platform = get_platform();
+  if (!platform.cpu_online) {
+    return platform.present_cpu_ids;
   }
-  // The AGX (tegra194) has similar files at /sys/kernel/debug/tegra_cpufreq/CLUSTER[0-3]/cc3/enable.
-  // On my machine, these are all '1', so I am not sure if they should be disabled.
 
-  write_file(path, to_string(min_freq));
+  // The online list is re-read on every call, but only parsed again after
+  // a cpu has been hotplugged. Each thread keeps its own copy.
+  static thread_local std::string online_list;
+  static thread_local std::vector<int> online_ids;
+  char buf[256];
+  long int n = platform.cpu_online->read(buf, sizeof(buf) - 1);
+  if (n < 0) {
+    throw JetsonClocksException("cannot read " +
+                                platform.cpu_online->path() + ": " +
+                                std::strerror(errno));
+  }
+  if (online_list.compare(0, std::string::npos, buf, n) != 0) {
+    online_list.assign(buf, n);
+    online_ids = parse_cpu_list(online_list.c_str());
+  }
+  return online_ids;
 }
 
-void set_cpu_max_freq(int cpu_id, long int max_freq) {
+std::vector<int> get_present_cpu_ids() {
   if (!running_as_root()) {
     throw JetsonClocksException(
-        "cannot set CPU max. freq. without root permissions.");
+        "cannot look up CPU ids without root permissions.");
   }
 
-  std::string path = "/sys/devices/system/cpu/cpu" + to_string(cpu_id) +
-                     "/cpufreq/scaling_max_freq";
-  if (!file_writable(path)) {
-    throw JetsonClocksException("cannot set cpu" + to_string(cpu_id) +
-                                " max. freq. because " + path +
-                                " is not writable.");
+  return get_platform().present_cpu_ids;
+}
+
+const CpuAttributes &get_cpu_attributes(int cpu_id) {
+  const Platform &platform = get_platform();
+  if (cpu_id < 0 || cpu_id >= static_cast<int>(platform.cpus.size()) ||
+      !platform.cpus[cpu_id].cur_freq) {
+    throw JetsonClocksException("cpu" + to_string(cpu_id) +
+                                " does not exist.");
+  }
+  return platform.cpus[cpu_id];
+}
+
+std::size_t get_policy_index(int policy_id) {
+  const Platform &platform = get_platform();
+  for (std::size_t i = 0; i < platform.clusters.size(); ++i) {
+    if (platform.clusters[i].policy_id == policy_id) {
+      return i;
+    }
+  }
+  throw JetsonClocksException("cpufreq policy" + to_string(policy_id) +
+                              " does not exist.");
+}
+
+std::size_t get_cpu_cluster_index(int cpu_id) {
+  get_cpu_attributes(cpu_id);
+  int index = get_platform().cpu_clusters[cpu_id];
+  if (index < 0) {
+    throw JetsonClocksException("cpu" + to_string(cpu_id) +
+                                " has no cpufreq policy.");
+  }
+  return static_cast<std::size_t>(index);
+}
+
+const CpuAttributes &get_policy_attributes(int policy_id) {
+  return get_platform().policies[get_policy_index(policy_id)];
+}
+
+Span<long int> get_freq_table(std::size_t cluster) {
+  const Platform &platform = get_platform();
+  const std::vector<long int> &table = platform.cluster_tables[cluster].freqs;
+  if (table.empty()) {
+    throw JetsonClocksException(
+        "cannot get cpu available frequencies because " +
+        platform.policies[cluster].available_freqs->path() +
+        " does not exist.");
+  }
+  return table;
+}
+
+Span<std::string> get_governor_table(std::size_t cluster) {
+  const Platform &platform = get_platform();
+  const std::vector<std::string> &table =
+      platform.cluster_tables[cluster].governors;
+  if (table.empty()) {
+    throw JetsonClocksException(
+        "cannot look up CPU available governors because " +
+        platform.policies[cluster].available_governors->path() +
+        " does not exist.");
+  }
+  return table;
+}
+
+const std::vector<std::string> &get_governor_list(std::size_t cluster) {
+  get_governor_table(cluster); // Throws if there are none.
+  return get_platform().cluster_tables[cluster].kernel_governors;
+}
+
+std::string read_governor(const CpuAttributes &cpu) {
+  Attribute &attr = *cpu.governor;
+
+  if (!attr.exists()) {
+    throw JetsonClocksException("cannot get cpu governor because " +
+                                attr.path() + " does not exist.");
   }
 
-  auto available_freqs = get_cpu_available_freqs(cpu_id);
+  return attr.read_string();
+}
+
+long int read_freq(Attribute &attr, const char *what) {
+  if (!attr.exists()) {
+    throw JetsonClocksException(std::string("cannot get ") + what +
+                                " because " + attr.path() +
+                                " does not exist.");
+  }
+
+  return attr.read_long();
+}
+
+void disable_cpu_qos(const Platform &platform) {
+  // Not every board or kernel has these, so missing ones are skipped.
+  // Reading first skips the write, and the work it triggers, once they are
+  // off. Failed writes to ones that exist are reported.
+  std::lock_guard<std::mutex> lock(get_domain_locks().qos);
+  if (platform.qos_enable) {
+    std::string current = read_current(*platform.qos_enable);
+    if (!current.empty() && current != "0") {
+      platform.qos_enable->write_long(0);
+    }
+  }
+  for (Attribute *cc3 : platform.cc3_enable) {
+    std::string current = read_current(*cc3);
+    if (!current.empty() && current != "0") {
+      cc3->write_long(0);
+    }
+  }
+}
+
+void write_min_freq(const CpuAttributes &cpu, Span<long int> available_freqs,
+                    const std::string &name, long int min_freq) {
+  Attribute &attr = *cpu.min_freq;
+  if (!attr.writable()) {
+    throw JetsonClocksException("cannot set " + name + " min. freq. because " +
+                                attr.path() + " is not writable.");
+  }
+
+  if (!available_freqs.contains(min_freq)) {
+    throw JetsonClocksException(to_string(min_freq) +
+                                " is not an available min. freq.");
+  }
+
+  disable_cpu_qos(get_platform());
+  attr.write_long(min_freq);
+}
 
-  if (std::find(available_freqs.begin(), available_freqs.end(), max_freq) ==
-      available_freqs.end()) {
+void write_max_freq(const CpuAttributes &cpu, Span<long int> available_freqs,
+                    const std::string &name, long int max_freq) {
+  Attribute &attr = *cpu.max_freq;
+  if (!attr.writable()) {
+    throw JetsonClocksException("cannot set " + name + " max. freq. because " +
+                                attr.path() + " is not writable.");
+  }
+
+  if (!available_freqs.contains(max_freq)) {
     throw JetsonClocksException(to_string(max_freq) +
                                 " is not an available max. freq.");
   }
 
-  write_file("/sys/module/qos/parameters/enable", "0");
+  disable_cpu_qos(get_platform());
+  attr.write_long(max_freq);
+}
+
+void write_governor(const CpuAttributes &cpu,
+                    Span<std::string> available_govs, const std::string &name,
+                    const std::string &governor) {
+  Attribute &attr = *cpu.governor;
+  if (!attr.writable()) {
+    throw JetsonClocksException("cannot set " + name + " governor because " +
+                                attr.path() + " is not writable.");
+  }
+
+  if (!available_govs.contains(governor)) {
+    throw JetsonClocksException(governor + " is not an available governor.");
+  }
+
+  disable_cpu_qos(get_platform());
+  attr.write_string(governor);
+}
+
+Span<long int> get_cpu_freq_table(int cpu_id) {
+  if (!running_as_root()) {
+    throw JetsonClocksException(
+        "cannot look up CPU available frequencies without root permissions.");
+  }
+
+  return get_freq_table(get_cpu_cluster_index(cpu_id));
+}
+
+Span<std::string> get_cpu_governor_table(int cpu_id) {
+  if (!running_as_root()) {
+    throw JetsonClocksException(
+        "cannot look up CPU available governors without root permissions.");
+  }
+
+  return get_governor_table(get_cpu_cluster_index(cpu_id));
+}
+
+std::vector<long int> get_cpu_available_freqs(int cpu_id) {
+  return get_cpu_freq_table(cpu_id).to_vector();
+}
+
+std::vector<std::string> get_cpu_available_governors(int cpu_id) {
+  if (!running_as_root()) {
+    throw JetsonClocksException(
+        "cannot look up CPU available governors without root permissions.");
+  }
+
+  return get_governor_list(get_cpu_cluster_index(cpu_id));
+}
+
+std::string get_cpu_governor(int cpu_id) {
+  if (!running_as_root()) {
+    throw JetsonClocksException(
+        "cannot get cpu governor without root permissions.");
+  }
+
+  return read_governor(get_cpu_attributes(cpu_id));
+}
+
+long int get_cpu_min_freq(int cpu_id) {
+  if (!running_as_root()) {
+    throw JetsonClocksException(
+        "cannot get cpu min. freq. without root permissions.");
+  }
+
+  return read_freq(*get_cpu_attributes(cpu_id).min_freq, "min. freq.");
+}
+
+long int get_cpu_max_freq(int cpu_id) {
+  if (!running_as_root()) {
+    throw JetsonClocksException(
+        "cannot get cpu max. freq. without root permissions.");
+  }
+
+  return read_freq(*get_cpu_attributes(cpu_id).max_freq, "max. freq.");
+}
+
+long int get_cpu_cur_freq(int cpu_id) {
+  if (!running_as_root()) {
+    throw JetsonClocksException(
+        "cannot get cpu current freq. without root permissions.");
+  }
+
+  return read_freq(*get_cpu_attributes(cpu_id).cur_freq,
+                   "current cpu freq.");
+}
+
+void set_cpu_min_freq(int cpu_id, long int min_freq) {
+  if (!running_as_root()) {
+    throw JetsonClocksException(
+        "cannot set CPU min. freq. without root permissions.");
+  }
+
+  std::lock_guard<std::mutex> lock(
+      get_domain_locks().policies[get_cpu_cluster_index(cpu_id)]);
+  write_min_freq(get_cpu_attributes(cpu_id), get_cpu_freq_table(cpu_id),
+                 "cpu" + to_string(cpu_id), min_freq);
+}
 
-  if (get_soc_family() == "tegra186") {
-    write_file("/sys/kernel/debug/tegra_cpufreq/M_CLUSTER/cc3/enable", "0");
-    write_file("/sys/kernel/debug/tegra_cpufreq/B_CLUSTER/cc3/enable", "0");
+void set_cpu_max_freq(int cpu_id, long int max_freq) {
+  if (!running_as_root()) {
+    throw JetsonClocksException(
+        "cannot set CPU max. freq. without root permissions.");
   }
-  // The AGX (tegra194) has similar files at /sys/kernel/debug/tegra_cpufreq/CLUSTER[0-3]/cc3/enable.
-  // On my machine, these are all '1', so I am not sure if they should be disabled.
 
-  write_file(path, to_string(max_freq));
+  std::lock_guard<std::mutex> lock(
+      get_domain_locks().policies[get_cpu_cluster_index(cpu_id)]);
+  write_max_freq(get_cpu_attributes(cpu_id), get_cpu_freq_table(cpu_id),
+                 "cpu" + to_string(cpu_id), max_freq);
 }
 
 void set_cpu_governor(int cpu_id, const std::string &governor) {
@@ -842,31 +3023,2585 @@ void set_cpu_governor(int cpu_id, const std::string &governor) {
         "cannot set CPU governor without root permissions.");
   }
 
-  std::string path = "/sys/devices/system/cpu/cpu" + to_string(cpu_id) +
-                     "/cpufreq/scaling_governor";
-  if (!file_exists(path)) {
-    throw JetsonClocksException("cannot set cpu" + to_string(cpu_id) +
-                                " governor because " + path +
-                                " is not writable.");
+  std::lock_guard<std::mutex> lock(
+      get_domain_locks().policies[get_cpu_cluster_index(cpu_id)]);
+  write_governor(get_cpu_attributes(cpu_id), get_cpu_governor_table(cpu_id),
+                 "cpu" + to_string(cpu_id), governor);
+}
+
+std::vector<CpuCluster> get_cpu_clusters() {
+  if (!running_as_root()) {
+    throw JetsonClocksException(
+        "cannot look up CPU clusters without root permissions.");
   }
 
-  auto available_govs = get_cpu_available_governors(cpu_id);
+  return get_platform().clusters;
+}
 
-  if (std::find(available_govs.begin(), available_govs.end(), governor) ==
-      available_govs.end()) {
-    throw JetsonClocksException(governor + " is not an available governor.");
+Span<long int> get_cluster_freq_table(int policy_id) {
+  if (!running_as_root()) {
+    throw JetsonClocksException(
+        "cannot look up cluster available frequencies without root "
+        "permissions.");
+  }
+
+  return get_freq_table(get_policy_index(policy_id));
+}
+
+Span<std::string> get_cluster_governor_table(int policy_id) {
+  if (!running_as_root()) {
+    throw JetsonClocksException(
+        "cannot look up cluster available governors without root "
+        "permissions.");
+  }
+
+  return get_governor_table(get_policy_index(policy_id));
+}
+
+std::vector<long int> get_cluster_available_freqs(int policy_id) {
+  return get_cluster_freq_table(policy_id).to_vector();
+}
+
+std::vector<std::string> get_cluster_available_governors(int policy_id) {
+  if (!running_as_root()) {
+    throw JetsonClocksException(
+        "cannot look up cluster available governors without root "
+        "permissions.");
   }
 
-  write_file("/sys/module/qos/parameters/enable", "0");
+  return get_governor_list(get_policy_index(policy_id));
+}
 
-  if (get_soc_family() == "tegra186") {
-    write_file("/sys/kernel/debug/tegra_cpufreq/M_CLUSTER/cc3/enable", "0");
-    write_file("/sys/kernel/debug/tegra_cpufreq/B_CLUSTER/cc3/enable", "0");
+std::string get_cluster_governor(int policy_id) {
+  if (!running_as_root()) {
+    throw JetsonClocksException(
+        "cannot get cluster governor without root permissions.");
   }
-  // The AGX (tegra194) has similar files at /sys/kernel/debug/tegra_cpufreq/CLUSTER[0-3]/cc3/enable.
-  // On my machine, these are all '1', so I am not sure if they should be disabled.
 
-  write_file(path, governor);
+  return read_governor(get_policy_attributes(policy_id));
+}
+
+long int get_cluster_min_freq(int policy_id) {
+  if (!running_as_root()) {
+    throw JetsonClocksException(
+        "cannot get cluster min. freq. without root permissions.");
+  }
+
+  return read_freq(*get_policy_attributes(policy_id).min_freq, "min. freq.");
+}
+
+long int get_cluster_max_freq(int policy_id) {
+  if (!running_as_root()) {
+    throw JetsonClocksException(
+        "cannot get cluster max. freq. without root permissions.");
+  }
+
+  return read_freq(*get_policy_attributes(policy_id).max_freq, "max. freq.");
+}
+
+long int get_cluster_cur_freq(int policy_id) {
+  if (!running_as_root()) {
+    throw JetsonClocksException(
+        "cannot get cluster current freq. without root permissions.");
+  }
+
+  return read_freq(*get_policy_attributes(policy_id).cur_freq,
+                   "current cluster freq.");
+}
+
+void set_cluster_min_freq(int policy_id, long int min_freq) {
+  if (!running_as_root()) {
+    throw JetsonClocksException(
+        "cannot set cluster min. freq. without root permissions.");
+  }
+
+  std::lock_guard<std::mutex> lock(
+      get_domain_locks().policies[get_policy_index(policy_id)]);
+  write_min_freq(get_policy_attributes(policy_id),
+                 get_cluster_freq_table(policy_id),
+                 "policy" + to_string(policy_id), min_freq);
+}
+
+void set_cluster_max_freq(int policy_id, long int max_freq) {
+  if (!running_as_root()) {
+    throw JetsonClocksException(
+        "cannot set cluster max. freq. without root permissions.");
+  }
+
+  std::lock_guard<std::mutex> lock(
+      get_domain_locks().policies[get_policy_index(policy_id)]);
+  write_max_freq(get_policy_attributes(policy_id),
+                 get_cluster_freq_table(policy_id),
+                 "policy" + to_string(policy_id), max_freq);
+}
+
+void set_cluster_governor(int policy_id, const std::string &governor) {
+  if (!running_as_root()) {
+    throw JetsonClocksException(
+        "cannot set cluster governor without root permissions.");
+  }
+
+  std::lock_guard<std::mutex> lock(
+      get_domain_locks().policies[get_policy_index(policy_id)]);
+  write_governor(get_policy_attributes(policy_id),
+                 get_cluster_governor_table(policy_id),
+                 "policy" + to_string(policy_id), governor);
+}
+
+std::vector<PowerRail> get_power_rails() {
+  if (!running_as_root()) {
+    throw JetsonClocksException(
+        "cannot look up power rails without root permissions.");
+  }
+
+  return get_platform().power_rails;
+}
+
+std::size_t get_power_rail_index(const std::string &rail) {
+  const std::vector<PowerRail> &rails = get_platform().power_rails;
+  for (std::size_t i = 0; i < rails.size(); ++i) {
+    if (rails[i].name == rail) {
+      return i;
+    }
+  }
+  for (std::size_t i = 0; i < rails.size(); ++i) {
+    if (rails[i].domain == rail) {
+      return i;
+    }
+  }
+  throw JetsonClocksException("power rail " + rail + " does not exist.");
+}
+
+PowerReading get_power_reading(const std::string &rail) {
+  if (!running_as_root()) {
+    throw JetsonClocksException(
+        "cannot read power rails without root permissions.");
+  }
+
+  const PowerRailAttributes &attrs =
+      get_platform().power_rail_attrs[get_power_rail_index(rail)];
+  PowerReading reading;
+  reading.voltage_mv = attrs.voltage->read_long();
+  reading.current_ma = attrs.current->read_long();
+  reading.power_mw = attrs.power
+                         ? attrs.power->read_long()
+                         : reading.voltage_mv * reading.current_ma / 1000;
+  return reading;
+}
+
+long int get_power_mw(const std::string &rail) {
+  return get_power_reading(rail).power_mw;
+}
+
+std::vector<ThermalZone> get_thermal_zones() {
+  if (!running_as_root()) {
+    throw JetsonClocksException(
+        "cannot look up thermal zones without root permissions.");
+  }
+
+  return get_platform().thermal_zones;
+}
+
+std::size_t get_thermal_zone_index(const std::string &zone) {
+  const std::vector<ThermalZone> &zones = get_platform().thermal_zones;
+  for (std::size_t i = 0; i < zones.size(); ++i) {
+    if (zones[i].type == zone) {
+      return i;
+    }
+  }
+  for (std::size_t i = 0; i < zones.size(); ++i) {
+    if (zones[i].domain == zone) {
+      return i;
+    }
+  }
+  throw JetsonClocksException("thermal zone " + zone + " does not exist.");
+}
+
+long int get_zone_temp(const std::string &zone) {
+  if (!running_as_root()) {
+    throw JetsonClocksException(
+        "cannot read thermal zones without root permissions.");
+  }
+
+  return get_platform()
+      .thermal_zone_temps[get_thermal_zone_index(zone)]
+      ->read_long();
+}
+
+long int get_thermal_headroom(const std::string &zone) {
+  if (!running_as_root()) {
+    throw JetsonClocksException(
+        "cannot read thermal zones without root permissions.");
+  }
+
+  const Platform &platform = get_platform();
+  std::size_t index = get_thermal_zone_index(zone);
+  long int trip_mc = platform.thermal_zone_trips[index];
+  if (trip_mc == std::numeric_limits<long int>::max()) {
+    throw JetsonClocksException("thermal zone " + zone +
+                                " has no passive, hot or critical trip point.");
+  }
+  return trip_mc - platform.thermal_zone_temps[index]->read_long();
+}
+
+ReadBatch::ReadBatch(const std::vector<Attribute *> &attrs,
+                     ReadBackend backend, std::size_t buf_size)
+    : attrs_(attrs), backend_(backend), buf_size_(buf_size),
+      buffers_(attrs.size() * buf_size), results_(attrs.size(), -1) {
+  if (backend_ == ReadBackend::io_uring && !setup_io_uring()) {
+    teardown_io_uring();
+    backend_ = ReadBackend::pread;
+  }
+}
+
+ReadBatch::~ReadBatch() { teardown_io_uring(); }
+
+void ReadBatch::read_all() {
+  if (backend_ == ReadBackend::io_uring && read_all_io_uring()) {
+    return;
+  }
+  for (std::size_t i = 0; i < attrs_.size(); ++i) {
+    results_[i] = attrs_[i]->read(data(i), buf_size_ - 1);
+  }
+}
+
+#ifdef JETSON_CLOCKS_USE_IO_URING
+
+bool ReadBatch::setup_io_uring() {
+  // Attributes that cannot be opened are left out of the ring.
+  std::vector<int> fds;
+  file_index_.assign(attrs_.size(), -1);
+  for (std::size_t i = 0; i < attrs_.size(); ++i) {
+    int fd = attrs_[i]->fd();
+    if (fd >= 0) {
+      file_index_[i] = static_cast<int>(fds.size());
+      fds.push_back(fd);
+    }
+  }
+  num_registered_ = fds.size();
+  if (fds.empty()) {
+    return false;
+  }
+
+  struct io_uring_params params;
+  std::memset(&params, 0, sizeof(params));
+  ring_fd_ = static_cast<int>(
+      syscall(__NR_io_uring_setup, static_cast<unsigned>(fds.size()), &params));
+  if (ring_fd_ < 0) {
+    return false;
+  }
+
+  sq_ring_size_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  cq_ring_size_ =
+      params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+  bool single_mmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+  if (single_mmap) {
+    sq_ring_size_ = cq_ring_size_ = std::max(sq_ring_size_, cq_ring_size_);
+  }
+  void *sq = mmap(nullptr, sq_ring_size_, PROT_READ | PROT_WRITE,
+                  MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQ_RING);
+  if (sq == MAP_FAILED) {
+    return false;
+  }
+  sq_ring_ = sq;
+  if (single_mmap) {
+    cq_ring_ = sq_ring_;
+  } else {
+    void *cq = mmap(nullptr, cq_ring_size_, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_CQ_RING);
+    if (cq == MAP_FAILED) {
+      return false;
+    }
+    cq_ring_ = cq;
+  }
+  sqes_size_ = params.sq_entries * sizeof(struct io_uring_sqe);
+  void *sqes = mmap(nullptr, sqes_size_, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQES);
+  if (sqes == MAP_FAILED) {
+    return false;
+  }
+  sqes_ = sqes;
+
+  char *sq_base = static_cast<char *>(sq_ring_);
+  char *cq_base = static_cast<char *>(cq_ring_);
+  sq_tail_ = reinterpret_cast<unsigned *>(sq_base + params.sq_off.tail);
+  sq_mask_ = reinterpret_cast<unsigned *>(sq_base + params.sq_off.ring_mask);
+  sq_array_ = reinterpret_cast<unsigned *>(sq_base + params.sq_off.array);
+  cq_head_ = reinterpret_cast<unsigned *>(cq_base + params.cq_off.head);
+  cq_tail_ = reinterpret_cast<unsigned *>(cq_base + params.cq_off.tail);
+  cq_mask_ = reinterpret_cast<unsigned *>(cq_base + params.cq_off.ring_mask);
+  cqes_ = cq_base + params.cq_off.cqes;
+
+  // Fixed files and buffers save the kernel a descriptor lookup and a page
+  // pinning on every read.
+  if (syscall(__NR_io_uring_register, ring_fd_, IORING_REGISTER_FILES,
+              fds.data(), static_cast<unsigned>(fds.size())) < 0) {
+    return false;
+  }
+  struct iovec iov;
+  iov.iov_base = buffers_.data();
+  iov.iov_len = buffers_.size();
+  if (syscall(__NR_io_uring_register, ring_fd_, IORING_REGISTER_BUFFERS, &iov,
+              1) < 0) {
+    return false;
+  }
+  return true;
+}
+
+void ReadBatch::teardown_io_uring() {
+  if (sqes_) {
+    munmap(sqes_, sqes_size_);
+  }
+  if (cq_ring_ && cq_ring_ != sq_ring_) {
+    munmap(cq_ring_, cq_ring_size_);
+  }
+  if (sq_ring_) {
+    munmap(sq_ring_, sq_ring_size_);
+  }
+  if (ring_fd_ >= 0) {
+    close(ring_fd_);
+  }
+  sqes_ = cq_ring_ = sq_ring_ = nullptr;
+  ring_fd_ = -1;
+}
+
+bool ReadBatch::read_all_io_uring() {
+  struct io_uring_sqe *sqes = static_cast<struct io_uring_sqe *>(sqes_);
+  struct io_uring_cqe *cqes = static_cast<struct io_uring_cqe *>(cqes_);
+
+  // This is the only producer, so the tail needs no atomic load, but the
+  // kernel must see the filled entries before it sees the new tail.
+  unsigned tail = *sq_tail_;
+  unsigned mask = *sq_mask_;
+  unsigned count = 0;
+  for (std::size_t i = 0; i < attrs_.size(); ++i) {
+    if (file_index_[i] < 0) {
+      results_[i] = -1;
+      continue;
+    }
+    unsigned index = tail & mask;
+    struct io_uring_sqe &sqe = sqes[index];
+    std::memset(&sqe, 0, sizeof(sqe));
+    sqe.opcode = IORING_OP_READ_FIXED;
+    sqe.flags = IOSQE_FIXED_FILE;
+    sqe.fd = file_index_[i];
+    sqe.addr = reinterpret_cast<unsigned long long>(data(i));
+    sqe.len = static_cast<unsigned>(buf_size_ - 1);
+    sqe.off = 0;
+    sqe.buf_index = 0;
+    sqe.user_data = i;
+    sq_array_[index] = index;
+    ++tail;
+    ++count;
+  }
+  __atomic_store_n(sq_tail_, tail, __ATOMIC_RELEASE);
+
+  unsigned submitted = 0;
+  unsigned completed = 0;
+  unsigned head = *cq_head_;
+  while (completed < count) {
+    long int ret = syscall(__NR_io_uring_enter, ring_fd_, count - submitted,
+                           count - completed, IORING_ENTER_GETEVENTS, nullptr,
+                           0);
+    if (ret < 0 && errno != EINTR) {
+      // Give up on the ring for good. Anything already queued completes into
+      // buffers we no longer look at until the next read_all().
+      teardown_io_uring();
+      backend_ = ReadBackend::pread;
+      return false;
+    }
+    if (ret > 0) {
+      submitted += static_cast<unsigned>(ret);
+    }
+    unsigned cq_mask = *cq_mask_;
+    while (head != __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE)) {
+      const struct io_uring_cqe &cqe = cqes[head & cq_mask];
+      results_[cqe.user_data] = cqe.res < 0 ? -1 : cqe.res;
+      ++head;
+      ++completed;
+    }
+    __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+  }
+  return true;
+}
+
+#else
+
+bool ReadBatch::setup_io_uring() { return false; }
+
+void ReadBatch::teardown_io_uring() {}
+
+bool ReadBatch::read_all_io_uring() { return false; }
+
+#endif
+
+long int snap_freq(Span<long int> table, long int target, Rounding rounding) {
+  if (table.empty()) {
+    throw JetsonClocksException("cannot snap to an empty frequency table.");
+  }
+
+  const long int *above = std::lower_bound(table.begin(), table.end(), target);
+  if (above == table.end()) {
+    return table.back();
+  }
+  if (*above == target || above == table.begin()) {
+    return *above;
+  }
+  const long int *below = above - 1;
+
+  switch (rounding) {
+  case Rounding::floor:
+    return *below;
+  case Rounding::ceil:
+    return *above;
+  default:
+    return (target - *below) <= (*above - target) ? *below : *above;
+  }
+}
+
+long int fraction_of_max(Span<long int> table, double fraction) {
+  if (table.empty()) {
+    throw JetsonClocksException("cannot scale an empty frequency table.");
+  }
+  fraction = std::min(std::max(fraction, 0.0), 1.0);
+  return static_cast<long int>(table.back() * fraction + 0.5);
+}
+
+long int snap_cpu_min_freq(int cpu_id, long int target, Rounding rounding) {
+  long int freq = snap_freq(get_cpu_freq_table(cpu_id), target, rounding);
+  set_cpu_min_freq(cpu_id, freq);
+  return freq;
+}
+
+long int snap_cpu_max_freq(int cpu_id, long int target, Rounding rounding) {
+  long int freq = snap_freq(get_cpu_freq_table(cpu_id), target, rounding);
+  set_cpu_max_freq(cpu_id, freq);
+  return freq;
+}
+
+long int snap_cluster_min_freq(int policy_id, long int target,
+                               Rounding rounding) {
+  long int freq =
+      snap_freq(get_cluster_freq_table(policy_id), target, rounding);
+  set_cluster_min_freq(policy_id, freq);
+  return freq;
+}
+
+long int snap_cluster_max_freq(int policy_id, long int target,
+                               Rounding rounding) {
+  long int freq =
+      snap_freq(get_cluster_freq_table(policy_id), target, rounding);
+  set_cluster_max_freq(policy_id, freq);
+  return freq;
+}
+
+std::pair<long int, long int> snap_gpu_freq_range(long int min_target,
+                                                  long int max_target,
+                                                  Rounding rounding) {
+  Span<long int> table = get_gpu_freq_table();
+  long int min_freq = snap_freq(table, min_target, rounding);
+  long int max_freq = snap_freq(table, max_target, rounding);
+  // Targets between two entries can snap past each other.
+  min_freq = std::min(min_freq, max_freq);
+  set_gpu_freq_range(min_freq, max_freq);
+  return std::make_pair(min_freq, max_freq);
+}
+
+bool ApplyReport::ok() const {
+  for (const ProfileWrite &write : writes) {
+    if (write.error != 0) {
+      return false;
+    }
+  }
+  return true;
+}
+
+ClockProfile max_performance_profile() {
+  if (!running_as_root()) {
+    throw JetsonClocksException(
+        "cannot build a clock profile without root permissions.");
+  }
+
+  const Platform &platform = get_platform();
+  ClockProfile profile;
+  for (std::size_t i = 0; i < platform.clusters.size(); ++i) {
+    const CpufreqTables &tables = platform.cluster_tables[i];
+    PolicyProfile policy;
+    policy.policy_id = platform.clusters[i].policy_id;
+    if (Span<std::string>(tables.governors).contains("performance")) {
+      policy.governor = "performance";
+    }
+    if (!tables.freqs.empty()) {
+      policy.min_freq = tables.freqs.back();
+      policy.max_freq = tables.freqs.back();
+    }
+    profile.policies.push_back(policy);
+  }
+
+  if (!platform.gpu_freq_table.empty()) {
+    profile.gpu_min_freq = platform.gpu_freq_table.back();
+    profile.gpu_max_freq = platform.gpu_freq_table.back();
+    if (platform.gpu_railgate) {
+      profile.gpu_railgate = 0;
+    }
+  }
+  if (!platform.emc_freq_table.empty() && platform.emc_override) {
+    profile.emc_freq = get_emc_available_freqs().back();
+    profile.emc_override = 1;
+  }
+  if (platform.fan_pwm && !platform.fan_always_on) {
+    profile.fan_speed = 255;
+  }
+  if (platform.qos_enable) {
+    profile.cpu_qos = 0;
+  }
+  profile.cc3.assign(platform.cc3_enable.size(), 0);
+  return profile;
+}
+
+ClockProfile read_profile() {
+  if (!running_as_root()) {
+    throw JetsonClocksException(
+        "cannot read the clock profile without root permissions.");
+  }
+
+  const Platform &platform = get_platform();
+  ClockProfile profile;
+  for (std::size_t i = 0; i < platform.clusters.size(); ++i) {
+    const CpuAttributes &attrs = platform.policies[i];
+    PolicyProfile policy;
+    policy.policy_id = platform.clusters[i].policy_id;
+    policy.governor = read_current(*attrs.governor);
+    policy.min_freq = read_current_long(attrs.min_freq, 0);
+    policy.max_freq = read_current_long(attrs.max_freq, 0);
+    profile.policies.push_back(policy);
+  }
+
+  profile.gpu_min_freq = read_current_long(platform.gpu_min_freq, 0);
+  profile.gpu_max_freq = read_current_long(platform.gpu_max_freq, 0);
+  profile.gpu_railgate = read_current_long(platform.gpu_railgate, -1);
+  profile.emc_override = read_current_long(platform.emc_override, -1);
+  if (profile.emc_override == 1) {
+    profile.emc_freq = read_current_long(platform.emc_rate, 0);
+  }
+  if (!platform.fan_always_on) {
+    profile.fan_speed = read_current_long(platform.fan_pwm, -1);
+  }
+  profile.cpu_qos = read_current_long(platform.qos_enable, -1);
+  for (Attribute *cc3 : platform.cc3_enable) {
+    profile.cc3.push_back(read_current_long(cc3, -1));
+  }
+  return profile;
+}
+
+// A write apply_profile() is going to make, with the value it replaces.
+struct PlannedWrite {
+  Attribute *attr;
+  std::string value;
+  std::string current;
+};
+
+void plan_write(std::vector<PlannedWrite> &plan, int &unchanged,
+                Attribute *attr, const std::string &value) {
+  std::string current = read_current(*attr);
+  if (current == value) {
+    ++unchanged;
+    return;
+  }
+  if (!attr->writable()) {
+    throw JetsonClocksException("cannot apply clock profile because " +
+                                attr->path() + " is not writable.");
+  }
+  plan.push_back(PlannedWrite{attr, value, current});
+}
+
+// Plan a min/max pair, writing the new max first when the new min is
+// above the current max so that min never exceeds max in between. When only
+// one end is given, it must not cross the current value of the other.
+void plan_range(std::vector<PlannedWrite> &plan, int &unchanged,
+                Attribute *min_attr, Attribute *max_attr, long int min_freq,
+                long int max_freq, const std::string &name) {
+  long int current_max = read_current_long(max_attr, 0);
+  if (min_freq && !max_freq && current_max && min_freq > current_max) {
+    throw JetsonClocksException("cannot apply clock profile because " + name +
+                                " min. freq. " + to_string(min_freq) +
+                                " is above its current max. freq. " +
+                                to_string(current_max) + ".");
+  }
+  long int current_min = read_current_long(min_attr, 0);
+  if (max_freq && !min_freq && current_min && max_freq < current_min) {
+    throw JetsonClocksException("cannot apply clock profile because " + name +
+                                " max. freq. " + to_string(max_freq) +
+                                " is below its current min. freq. " +
+                                to_string(current_min) + ".");
+  }
+
+  std::size_t first = plan.size();
+  if (min_freq) {
+    plan_write(plan, unchanged, min_attr, to_string(min_freq));
+  }
+  bool min_planned = plan.size() > first;
+  if (max_freq) {
+    plan_write(plan, unchanged, max_attr, to_string(max_freq));
+  }
+  if (min_planned && plan.size() == first + 2 &&
+      min_freq > parse_current(plan[first + 1].current, 0)) {
+    std::swap(plan[first], plan[first + 1]);
+  }
+}
+
+void check_range(Span<long int> table, long int min_freq, long int max_freq,
+                 const std::string &name) {
+  if (min_freq && !table.contains(min_freq)) {
+    throw JetsonClocksException(to_string(min_freq) +
+                                " is not an available " + name +
+                                " min. freq.");
+  }
+  if (max_freq && !table.contains(max_freq)) {
+    throw JetsonClocksException(to_string(max_freq) +
+                                " is not an available " + name +
+                                " max. freq.");
+  }
+  if (min_freq && max_freq && min_freq > max_freq) {
+    throw JetsonClocksException(name + " min. freq. is above its max. freq.");
+  }
+}
+
+const char *flag_value(int flag) { return flag ? "1" : "0"; }
+
+std::vector<PlannedWrite> plan_profile(const ClockProfile &profile,
+                                       int &unchanged) {
+  const Platform &platform = get_platform();
+  std::vector<PlannedWrite> plan;
+
+  // Like the cpu setters, turn off qos and cc3 before touching cpufreq.
+  if (profile.cpu_qos >= 0 && platform.qos_enable) {
+    plan_write(plan, unchanged, platform.qos_enable,
+               flag_value(profile.cpu_qos));
+  }
+  if (!profile.cc3.empty() &&
+      profile.cc3.size() != platform.cc3_enable.size()) {
+    throw JetsonClocksException("cannot apply clock profile because it has " +
+                                to_string(profile.cc3.size()) +
+                                " cc3 flags and this board has " +
+                                to_string(platform.cc3_enable.size()) + ".");
+  }
+  for (std::size_t i = 0; i < profile.cc3.size(); ++i) {
+    if (profile.cc3[i] >= 0) {
+      plan_write(plan, unchanged, platform.cc3_enable[i],
+                 flag_value(profile.cc3[i]));
+    }
+  }
+
+  for (const PolicyProfile &policy : profile.policies) {
+    std::size_t cluster = get_policy_index(policy.policy_id);
+    const CpuAttributes &attrs = platform.policies[cluster];
+    std::string name = "policy" + to_string(policy.policy_id);
+    if (!policy.governor.empty()) {
+      if (!get_governor_table(cluster).contains(policy.governor)) {
+        throw JetsonClocksException(policy.governor +
+                                    " is not an available governor.");
+      }
+      plan_write(plan, unchanged, attrs.governor, policy.governor);
+    }
+    if (policy.min_freq || policy.max_freq) {
+      check_range(get_freq_table(cluster), policy.min_freq, policy.max_freq,
+                  name);
+      plan_range(plan, unchanged, attrs.min_freq, attrs.max_freq,
+                 policy.min_freq, policy.max_freq, name);
+    }
+  }
+
+  if (profile.gpu_railgate >= 0 && platform.gpu_railgate) {
+    plan_write(plan, unchanged, platform.gpu_railgate,
+               flag_value(profile.gpu_railgate));
+  }
+  if (profile.gpu_min_freq || profile.gpu_max_freq) {
+    check_range(get_gpu_freq_table(), profile.gpu_min_freq,
+                profile.gpu_max_freq, "gpu");
+    plan_range(plan, unchanged, platform.gpu_min_freq, platform.gpu_max_freq,
+               profile.gpu_min_freq, profile.gpu_max_freq, "gpu");
+  }
+
+  if (profile.emc_freq) {
+    std::vector<long int> emc_freqs = get_emc_available_freqs();
+    if (profile.emc_freq < emc_freqs.front() ||
+        profile.emc_freq > emc_freqs.back() || !platform.emc_override) {
+      throw JetsonClocksException("emc frequency not in acceptable range.");
+    }
+    long int emc_freq = snap_freq(emc_freqs, profile.emc_freq, Rounding::ceil);
+    plan_write(plan, unchanged, platform.emc_rate, to_string(emc_freq));
+  }
+  if ((profile.emc_freq || profile.emc_override >= 0) &&
+      platform.emc_override) {
+    plan_write(plan, unchanged, platform.emc_override,
+               flag_value(profile.emc_freq ? 1 : profile.emc_override));
+  }
+
+  if (profile.fan_speed >= 0 && !platform.fan_always_on) {
+    if (!platform.fan_pwm) {
+      throw JetsonClocksException("fan speed file not found.");
+    }
+    if (profile.fan_speed > 255) {
+      throw JetsonClocksException("fan speed must be between 0 and 255.");
+    }
+    plan_write(plan, unchanged, platform.fan_pwm,
+               to_string(profile.fan_speed));
+  }
+  return plan;
+}
+
+// Hold every domain in lock order, so the state a plan was made from cannot
+// change before it is written.
+std::vector<std::unique_lock<std::mutex>> lock_all_domains() {
+  DomainLocks &locks = get_domain_locks();
+  std::vector<std::unique_lock<std::mutex>> held;
+  for (std::mutex &policy : locks.policies) {
+    held.emplace_back(policy);
+  }
+  for (std::mutex *domain : {&locks.gpu, &locks.emc, &locks.fan, &locks.qos}) {
+    held.emplace_back(*domain);
+  }
+  return held;
+}
+
+// The order in which to undo the first n writes of a plan. Undoing in
+// reverse keeps every min/max pair valid on the way back, but the EMC rate
+// goes back first: plan_profile() sets the rate before the override for
+// the same reason, so the clock is never left unlocked at the wrong rate.
+std::vector<std::size_t> undo_order(const std::vector<PlannedWrite> &plan,
+                                    std::size_t n) {
+  const Platform &platform = get_platform();
+  std::vector<std::size_t> order;
+  for (std::size_t j = n; j-- > 0;) {
+    if (platform.emc_rate && plan[j].attr == platform.emc_rate) {
+      order.insert(order.begin(), j);
+    } else {
+      order.push_back(j);
+    }
+  }
+  return order;
+}
+
+// Make the writes of a plan, rolling back if one fails. The caller holds
+// every domain lock.
+ApplyReport apply_plan(const std::vector<PlannedWrite> &plan, int unchanged) {
+  ApplyReport report;
+  report.unchanged = unchanged;
+  for (std::size_t i = 0; i < plan.size(); ++i) {
+    const PlannedWrite &write = plan[i];
+    int err = write.attr->write(write.value.data(), write.value.size());
+    report.writes.push_back(ProfileWrite{write.attr->path(), write.value, err});
+    if (err == 0) {
+      continue;
+    }
+
+    // This is best-effort: the board was already in that state.
+    for (std::size_t j : undo_order(plan, i)) {
+      const PlannedWrite &undo = plan[j];
+      if (!undo.current.empty()) {
+        undo.attr->write(undo.current.data(), undo.current.size());
+      }
+    }
+    report.rolled_back = i > 0;
+    break;
+  }
+  return report;
+}
+
+ApplyReport apply_profile(const ClockProfile &profile) {
+  if (!running_as_root()) {
+    throw JetsonClocksException(
+        "cannot apply a clock profile without root permissions.");
+  }
+
+  std::vector<std::unique_lock<std::mutex>> held = lock_all_domains();
+  int unchanged = 0;
+  std::vector<PlannedWrite> plan = plan_profile(profile, unchanged);
+  return apply_plan(plan, unchanged);
+}
+
+// Saved state layout, all integers little-endian:
+//   "JCST", u16 version, u8 SocFamily, u8 number of policies,
+//   i64 gpu_min_freq, i64 gpu_max_freq, i64 emc_freq,
+//   i8 gpu_railgate, i8 emc_override, i16 fan_speed, i8 cpu_qos,
+//   u8 number of cc3 flags, i8 for each cc3 flag,
+//   then for each policy:
+//   i32 policy_id, i64 min_freq, i64 max_freq, u8 length, governor.
+const unsigned char state_magic[4] = {'J', 'C', 'S', 'T'};
+const unsigned int state_version = 1;
+
+void put_state_int(std::vector<unsigned char> &out, long long int value,
+                   int bytes) {
+  unsigned long long int bits = static_cast<unsigned long long int>(value);
+  for (int i = 0; i < bytes; ++i) {
+    out.push_back(static_cast<unsigned char>(bits >> (8 * i)));
+  }
+}
+
+long long int get_state_int(const std::vector<unsigned char> &in,
+                            std::size_t &pos, int bytes) {
+  if (in.size() - pos < static_cast<std::size_t>(bytes)) {
+    throw JetsonClocksException("saved clock state is truncated.");
+  }
+  unsigned long long int bits = 0;
+  for (int i = 0; i < bytes; ++i) {
+    bits |= static_cast<unsigned long long int>(in[pos++]) << (8 * i);
+  }
+  // Sign-extend values narrower than 64 bits.
+  if (bytes < 8 && (bits >> (8 * bytes - 1)) & 1) {
+    bits |= ~0ULL << (8 * bytes);
+  }
+  return static_cast<long long int>(bits);
+}
+
+std::vector<unsigned char> save_state() {
+  ClockProfile profile = read_profile();
+
+  std::vector<unsigned char> out(state_magic, state_magic + 4);
+  put_state_int(out, state_version, 2);
+  put_state_int(out, static_cast<int>(get_platform().family), 1);
+  put_state_int(out, profile.policies.size(), 1);
+  put_state_int(out, profile.gpu_min_freq, 8);
+  put_state_int(out, profile.gpu_max_freq, 8);
+  put_state_int(out, profile.emc_freq, 8);
+  put_state_int(out, profile.gpu_railgate, 1);
+  put_state_int(out, profile.emc_override, 1);
+  put_state_int(out, profile.fan_speed, 2);
+  put_state_int(out, profile.cpu_qos, 1);
+  std::size_t num_cc3 = std::min<std::size_t>(profile.cc3.size(), 255);
+  put_state_int(out, num_cc3, 1);
+  for (std::size_t i = 0; i < num_cc3; ++i) {
+    put_state_int(out, profile.cc3[i], 1);
+  }
+  for (const PolicyProfile &policy : profile.policies) {
+    put_state_int(out, policy.policy_id, 4);
+    put_state_int(out, policy.min_freq, 8);
+    put_state_int(out, policy.max_freq, 8);
+    std::size_t length = std::min<std::size_t>(policy.governor.size(), 255);
+    put_state_int(out, length, 1);
+    out.insert(out.end(), policy.governor.begin(),
+               policy.governor.begin() + length);
+  }
+  return out;
+}
+
+void save_state(const std::string &path) {
+  std::vector<unsigned char> state = save_state();
+  std::ofstream out(path.c_str(), std::ios::binary | std::ios::trunc);
+  out.write(reinterpret_cast<const char *>(state.data()), state.size());
+  out.close();
+  if (!out) {
+    throw JetsonClocksException("cannot save clock state to " + path + ".");
+  }
+}
+
+ApplyReport restore_state(const std::vector<unsigned char> &state) {
+  if (state.size() < 4 || !std::equal(state_magic, state_magic + 4,
+                                      state.begin())) {
+    throw JetsonClocksException("saved clock state is not recognized.");
+  }
+  std::size_t pos = 4;
+  if (get_state_int(state, pos, 2) != state_version) {
+    throw JetsonClocksException("saved clock state has an unknown version.");
+  }
+  SocFamily family = static_cast<SocFamily>(get_state_int(state, pos, 1));
+  if (family != get_platform().family) {
+    throw JetsonClocksException(
+        std::string("saved clock state is for SOC family ") +
+        get_soc_family_name(family) + ", not " + get_platform().soc_family +
+        ".");
+  }
+
+  ClockProfile profile;
+  std::size_t num_policies = get_state_int(state, pos, 1) & 0xff;
+  profile.gpu_min_freq = get_state_int(state, pos, 8);
+  profile.gpu_max_freq = get_state_int(state, pos, 8);
+  profile.emc_freq = get_state_int(state, pos, 8);
+  profile.gpu_railgate = get_state_int(state, pos, 1);
+  profile.emc_override = get_state_int(state, pos, 1);
+  profile.fan_speed = get_state_int(state, pos, 2);
+  profile.cpu_qos = get_state_int(state, pos, 1);
+  std::size_t num_cc3 = get_state_int(state, pos, 1) & 0xff;
+  for (std::size_t i = 0; i < num_cc3; ++i) {
+    profile.cc3.push_back(get_state_int(state, pos, 1));
+  }
+  for (std::size_t i = 0; i < num_policies; ++i) {
+    PolicyProfile policy;
+    policy.policy_id = get_state_int(state, pos, 4);
+    policy.min_freq = get_state_int(state, pos, 8);
+    policy.max_freq = get_state_int(state, pos, 8);
+    std::size_t length = get_state_int(state, pos, 1) & 0xff;
+    if (state.size() - pos < length) {
+      throw JetsonClocksException("saved clock state is truncated.");
+    }
+    policy.governor.assign(state.begin() + pos, state.begin() + pos + length);
+    pos += length;
+    profile.policies.push_back(policy);
+  }
+
+  return apply_profile(profile);
+}
+
+ApplyReport restore_state(const std::string &path) {
+  std::ifstream in(path.c_str(), std::ios::binary);
+  if (!in) {
+    throw JetsonClocksException("cannot open saved clock state " + path +
+                                ".");
+  }
+  std::vector<unsigned char> state((std::istreambuf_iterator<char>(in)),
+                                   std::istreambuf_iterator<char>());
+  return restore_state(state);
+}
+
+// The boost reference count of each BoostDomain bit, and the writes the
+// first guard made to raise it.
+struct BoostState {
+  std::mutex mutex;
+  int count[3] = {0, 0, 0};
+  std::vector<PlannedWrite> writes[3];
+};
+
+BoostState &get_boost_state() {
+  static BoostState state;
+  return state;
+}
+
+// Copy the settings of a single boost domain out of a profile.
+ClockProfile boost_domain_profile(const ClockProfile &from, unsigned domain) {
+  ClockProfile profile;
+  if (domain == static_cast<unsigned>(BoostDomain::cpu)) {
+    for (PolicyProfile policy : from.policies) {
+      policy.governor.clear();
+      profile.policies.push_back(policy);
+    }
+  } else if (domain == static_cast<unsigned>(BoostDomain::gpu)) {
+    profile.gpu_min_freq = from.gpu_min_freq;
+    profile.gpu_max_freq = from.gpu_max_freq;
+  } else {
+    profile.emc_freq = from.emc_freq;
+    profile.emc_override = from.emc_override;
+  }
+  return profile;
+}
+
+// Check that writing value to attr keeps it on its side of the other end
+// of its min/max pair, as plan_range() requires.
+bool keeps_range(Attribute *attr, long int value) {
+  const Platform &platform = get_platform();
+  std::vector<std::pair<Attribute *, Attribute *>> ranges;
+  for (const CpuAttributes &policy : platform.policies) {
+    ranges.emplace_back(policy.min_freq, policy.max_freq);
+  }
+  ranges.emplace_back(platform.gpu_min_freq, platform.gpu_max_freq);
+  for (const std::pair<Attribute *, Attribute *> &range : ranges) {
+    if (attr == range.first) {
+      long int max_freq = read_current_long(range.second, 0);
+      return !max_freq || value <= max_freq;
+    }
+    if (attr == range.second) {
+      return value >= read_current_long(range.first, 0);
+    }
+  }
+  return true;
+}
+
+// Put back what a boost wrote, in reverse order as apply_profile() rolls
+// back. An attribute that no longer holds the boost's value was changed by
+// someone else while the boost was held, and is left alone.
+void undo_boost(const std::vector<PlannedWrite> &writes) {
+  std::vector<std::unique_lock<std::mutex>> held = lock_all_domains();
+  for (std::size_t j : undo_order(writes, writes.size())) {
+    const PlannedWrite &undo = writes[j];
+    if (undo.current.empty() || read_current(*undo.attr) != undo.value ||
+        !keeps_range(undo.attr, parse_current(undo.current, 0))) {
+      continue;
+    }
+    // Best-effort, there is nothing a destructor can do about a failure.
+    undo.attr->write(undo.current.data(), undo.current.size());
+  }
+}
+
+void release_boost(BoostState &state, unsigned held) {
+  for (int i = 0; i < 3; ++i) {
+    if (!(held & (1u << i)) || --state.count[i] > 0) {
+      continue;
+    }
+    undo_boost(state.writes[i]);
+    state.writes[i].clear();
+  }
+}
+
+ScopedBoost::ScopedBoost(BoostDomain domains) : held_(0) {
+  if (!running_as_root()) {
+    throw JetsonClocksException(
+        "cannot boost clocks without root permissions.");
+  }
+
+  BoostState &state = get_boost_state();
+  std::lock_guard<std::mutex> lock(state.mutex);
+  try {
+    bool loaded = false;
+    ClockProfile max_profile;
+    for (int i = 0; i < 3; ++i) {
+      unsigned domain = 1u << i;
+      if (!(static_cast<unsigned>(domains) & domain)) {
+        continue;
+      }
+      if (state.count[i] == 0) {
+        if (!loaded) {
+          max_profile = max_performance_profile();
+          loaded = true;
+        }
+        std::vector<std::unique_lock<std::mutex>> held = lock_all_domains();
+        int unchanged = 0;
+        std::vector<PlannedWrite> plan =
+            plan_profile(boost_domain_profile(max_profile, domain), unchanged);
+        ApplyReport report = apply_plan(plan, unchanged);
+        if (!report.ok()) {
+          const ProfileWrite &failed = report.writes.back();
+          throw JetsonClocksException("cannot boost clocks because " +
+                                      failed.path + " rejected " +
+                                      failed.value + ": " +
+                                      std::strerror(failed.error));
+        }
+        state.writes[i] = plan;
+      }
+      ++state.count[i];
+      held_ |= domain;
+    }
+  } catch (...) {
+    release_boost(state, held_);
+    throw;
+  }
+}
+
+ScopedBoost::~ScopedBoost() {
+  BoostState &state = get_boost_state();
+  std::lock_guard<std::mutex> lock(state.mutex);
+  release_boost(state, held_);
+}
+
+long long int monotonic_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/// The fields of a Snapshot that are read from an attribute.
+enum class SnapshotField {
+  cpu_cur_freq,
+  cpu_min_freq,
+  cpu_max_freq,
+  cpu_governor,
+  gpu_cur_freq,
+  gpu_min_freq,
+  gpu_max_freq,
+  gpu_load,
+  emc_freq,
+  fan_pwm,
+  rail_voltage,
+  rail_current,
+  rail_power,
+  zone_temp
+};
+
+/// One attribute read of a snapshot, and the fields it fills. A cluster's
+/// governor and limits are read once and stored in the slot of every cpu in
+/// the cluster.
+struct SnapshotRead {
+  Attribute *attr;
+  SnapshotField field;
+  std::vector<int> slots; // Indexes into Snapshot::cpus, or into
+                          // Snapshot::rails or zones for their fields.
+};
+
+std::vector<SnapshotRead> plan_snapshot_reads(const Platform &platform) {
+  std::vector<SnapshotRead> reads;
+
+  const std::vector<int> &cpu_ids = platform.possible_cpu_ids;
+  int num_cpus = std::min(static_cast<int>(cpu_ids.size()),
+                          JETSON_CLOCKS_MAX_CPUS);
+  for (int slot = 0; slot < num_cpus; ++slot) {
+    reads.push_back({platform.cpus[cpu_ids[slot]].cur_freq,
+                     SnapshotField::cpu_cur_freq, {slot}});
+  }
+
+  for (std::size_t i = 0; i < platform.clusters.size(); ++i) {
+    std::vector<int> slots;
+    for (int cpu_id : platform.clusters[i].cpu_ids) {
+      auto it = std::find(cpu_ids.begin(), cpu_ids.begin() + num_cpus, cpu_id);
+      if (it != cpu_ids.begin() + num_cpus) {
+        slots.push_back(static_cast<int>(it - cpu_ids.begin()));
+      }
+    }
+    const CpuAttributes &policy = platform.policies[i];
+    reads.push_back({policy.min_freq, SnapshotField::cpu_min_freq, slots});
+    reads.push_back({policy.max_freq, SnapshotField::cpu_max_freq, slots});
+    reads.push_back({policy.governor, SnapshotField::cpu_governor, slots});
+  }
+
+  std::pair<Attribute *, SnapshotField> board[] = {
+      {platform.gpu_cur_freq, SnapshotField::gpu_cur_freq},
+      {platform.gpu_min_freq, SnapshotField::gpu_min_freq},
+      {platform.gpu_max_freq, SnapshotField::gpu_max_freq},
+      {platform.gpu_load, SnapshotField::gpu_load},
+      {platform.emc_rate, SnapshotField::emc_freq},
+      {platform.fan_always_on ? nullptr : platform.fan_pwm,
+       SnapshotField::fan_pwm}};
+  for (const auto &entry : board) {
+    if (entry.first) {
+      reads.push_back({entry.first, entry.second, {}});
+    }
+  }
+
+  int num_rails = std::min(static_cast<int>(platform.power_rails.size()),
+                           JETSON_CLOCKS_MAX_RAILS);
+  for (int slot = 0; slot < num_rails; ++slot) {
+    const PowerRailAttributes &rail = platform.power_rail_attrs[slot];
+    reads.push_back({rail.voltage, SnapshotField::rail_voltage, {slot}});
+    reads.push_back({rail.current, SnapshotField::rail_current, {slot}});
+    if (rail.power) {
+      reads.push_back({rail.power, SnapshotField::rail_power, {slot}});
+    }
+  }
+
+  int num_zones = std::min(static_cast<int>(platform.thermal_zones.size()),
+                           JETSON_CLOCKS_MAX_ZONES);
+  for (int slot = 0; slot < num_zones; ++slot) {
+    reads.push_back({platform.thermal_zone_temps[slot],
+                     SnapshotField::zone_temp,
+                     {slot}});
+  }
+  return reads;
+}
+
+const std::vector<SnapshotRead> &get_snapshot_reads() {
+  static const std::vector<SnapshotRead> reads =
+      plan_snapshot_reads(get_platform());
+  return reads;
+}
+
+std::atomic<ReadBackend> &get_snapshot_backend() {
+  static std::atomic<ReadBackend> backend(ReadBackend::pread);
+  return backend;
+}
+
+void set_snapshot_backend(ReadBackend backend) {
+  get_snapshot_backend() = backend;
+}
+
+// Each thread has its own batch, so concurrent snapshots share no buffers.
+// It is rebuilt when the requested backend changes.
+ReadBatch &get_snapshot_batch() {
+  static thread_local std::unique_ptr<ReadBatch> batch;
+  static thread_local ReadBackend batch_backend;
+  ReadBackend backend = get_snapshot_backend();
+  if (!batch || batch_backend != backend) {
+    std::vector<Attribute *> attrs;
+    for (const SnapshotRead &read : get_snapshot_reads()) {
+      attrs.push_back(read.attr);
+    }
+    batch.reset(new ReadBatch(attrs, backend));
+    batch_backend = backend;
+  }
+  return *batch;
+}
+
+/// Parse an integer from the n bytes of buf, which must have room for a
+/// terminator. Returns -1 if the read failed or nothing could be parsed.
+long int parse_long(char *buf, long int n) {
+  if (n <= 0) {
+    return -1;
+  }
+  buf[n] = '\0';
+  char *end = nullptr;
+  long int value = std::strtol(buf, &end, 10);
+  return end == buf ? -1 : value;
+}
+
+void store_snapshot_read(Snapshot &out, const SnapshotRead &read, char *buf,
+                         long int n) {
+  if (read.field == SnapshotField::cpu_governor) {
+    std::size_t len = 0;
+    if (n > 0) {
+      len = std::min(static_cast<std::size_t>(n),
+                     sizeof(out.cpus[0].governor) - 1);
+      while (len > 0 && buf[len - 1] == '\n') {
+        --len;
+      }
+    }
+    for (int slot : read.slots) {
+      std::memcpy(out.cpus[slot].governor, buf, len);
+      out.cpus[slot].governor[len] = '\0';
+    }
+    return;
+  }
+
+  long int value = parse_long(buf, n);
+  switch (read.field) {
+  case SnapshotField::cpu_cur_freq:
+  case SnapshotField::cpu_min_freq:
+  case SnapshotField::cpu_max_freq:
+    for (int slot : read.slots) {
+      CpuSnapshot &cpu = out.cpus[slot];
+      if (read.field == SnapshotField::cpu_cur_freq) {
+        cpu.cur_freq = value;
+      } else if (read.field == SnapshotField::cpu_min_freq) {
+        cpu.min_freq = value;
+      } else {
+        cpu.max_freq = value;
+      }
+    }
+    break;
+  case SnapshotField::gpu_cur_freq:
+    out.gpu_cur_freq = value;
+    break;
+  case SnapshotField::gpu_min_freq:
+    out.gpu_min_freq = value;
+    break;
+  case SnapshotField::gpu_max_freq:
+    out.gpu_max_freq = value;
+    break;
+  case SnapshotField::gpu_load:
+    out.gpu_load = static_cast<int>(value);
+    break;
+  case SnapshotField::emc_freq:
+    out.emc_freq = value;
+    break;
+  case SnapshotField::fan_pwm:
+    out.fan_pwm = static_cast<int>(value);
+    break;
+  case SnapshotField::rail_voltage:
+    out.rails[read.slots[0]].voltage_mv = value;
+    break;
+  case SnapshotField::rail_current:
+    out.rails[read.slots[0]].current_ma = value;
+    break;
+  case SnapshotField::rail_power:
+    out.rails[read.slots[0]].power_mw = value;
+    break;
+  case SnapshotField::zone_temp:
+    out.zones[read.slots[0]].temp_mc = value;
+    break;
+  default:
+    break;
+  }
+}
+
+void clear_snapshot(Snapshot &out, const Platform &platform) {
+  const std::vector<int> &cpu_ids = platform.possible_cpu_ids;
+  out.num_cpus = std::min(static_cast<int>(cpu_ids.size()),
+                          JETSON_CLOCKS_MAX_CPUS);
+  for (int slot = 0; slot < out.num_cpus; ++slot) {
+    CpuSnapshot &cpu = out.cpus[slot];
+    cpu.cpu_id = cpu_ids[slot];
+    cpu.cur_freq = -1;
+    cpu.min_freq = -1;
+    cpu.max_freq = -1;
+    cpu.effective_freq = -1;
+    cpu.busy_us = -1;
+    cpu.governor[0] = '\0';
+  }
+  out.gpu_cur_freq = -1;
+  out.gpu_min_freq = -1;
+  out.gpu_max_freq = -1;
+  out.gpu_load = -1;
+  out.emc_freq = -1;
+  out.fan_pwm = platform.fan_always_on ? 255 : -1;
+
+  out.num_rails = std::min(static_cast<int>(platform.power_rails.size()),
+                           JETSON_CLOCKS_MAX_RAILS);
+  for (int slot = 0; slot < out.num_rails; ++slot) {
+    RailSnapshot &rail = out.rails[slot];
+    const std::string &name = platform.power_rails[slot].name;
+    std::size_t len = std::min(name.size(), sizeof(rail.name) - 1);
+    std::memcpy(rail.name, name.data(), len);
+    rail.name[len] = '\0';
+    rail.voltage_mv = -1;
+    rail.current_ma = -1;
+    rail.power_mw = -1;
+  }
+
+  out.num_zones = std::min(static_cast<int>(platform.thermal_zones.size()),
+                           JETSON_CLOCKS_MAX_ZONES);
+  for (int slot = 0; slot < out.num_zones; ++slot) {
+    ZoneSnapshot &zone = out.zones[slot];
+    const std::string &type = platform.thermal_zones[slot].type;
+    std::size_t len = std::min(type.size(), sizeof(zone.type) - 1);
+    std::memcpy(zone.type, type.data(), len);
+    zone.type[len] = '\0';
+    zone.temp_mc = -1;
+    zone.headroom_mc = std::numeric_limits<long int>::max();
+  }
+}
+
+// Work out the power of rails whose driver only reports voltage and current.
+void compute_rail_power(Snapshot &out, const Platform &platform) {
+  for (int slot = 0; slot < out.num_rails; ++slot) {
+    RailSnapshot &rail = out.rails[slot];
+    if (!platform.power_rail_attrs[slot].power && rail.voltage_mv >= 0 &&
+        rail.current_ma >= 0) {
+      rail.power_mw = rail.voltage_mv * rail.current_ma / 1000;
+    }
+  }
+}
+
+void compute_zone_headroom(Snapshot &out, const Platform &platform) {
+  for (int slot = 0; slot < out.num_zones; ++slot) {
+    ZoneSnapshot &zone = out.zones[slot];
+    long int trip_mc = platform.thermal_zone_trips[slot];
+    if (trip_mc != std::numeric_limits<long int>::max() &&
+        zone.temp_mc != -1) {
+      zone.headroom_mc = trip_mc - zone.temp_mc;
+    }
+  }
+}
+
+void snapshot(Snapshot &out) {
+  if (!running_as_root()) {
+    throw JetsonClocksException(
+        "cannot take a snapshot without root permissions.");
+  }
+
+  const Platform &platform = get_platform();
+  const std::vector<SnapshotRead> &reads = get_snapshot_reads();
+  ReadBatch &batch = get_snapshot_batch();
+
+  out.start_ns = monotonic_ns();
+  clear_snapshot(out, platform);
+  batch.read_all();
+  for (std::size_t i = 0; i < reads.size(); ++i) {
+    store_snapshot_read(out, reads[i], batch.data(i), batch.result(i));
+  }
+  compute_rail_power(out, platform);
+  compute_zone_headroom(out, platform);
+  out.end_ns = monotonic_ns();
+}
+
+Snapshot snapshot() {
+  Snapshot out;
+  snapshot(out);
+  return out;
+}
+
+// Open a cycles counter on one cpu for every task. The enabled and running
+// times are read with it, so a counter multiplexed with other events is
+// measured only over the time it actually counted.
+int open_cycle_counter(int cpu_id) {
+  perf_event_attr attr;
+  std::memset(&attr, 0, sizeof(attr));
+  attr.type = PERF_TYPE_HARDWARE;
+  attr.size = sizeof(attr);
+  attr.config = PERF_COUNT_HW_CPU_CYCLES;
+  attr.read_format =
+      PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+  return static_cast<int>(syscall(SYS_perf_event_open, &attr, -1, cpu_id, -1,
+                                  PERF_FLAG_FD_CLOEXEC));
+}
+
+// The cycles of an interval of enabled_ns per busy nanosecond, in kHz.
+// A counter multiplexed with other events counted only for running_ns of
+// the interval, so its count is scaled up to the whole of it. -1 if the
+// counter did not run or the cpu was never busy.
+long int effective_freq_khz(unsigned long long int cycles,
+                            unsigned long long int enabled_ns,
+                            unsigned long long int running_ns,
+                            long long int busy_ns) {
+  if (running_ns == 0 || busy_ns <= 0) {
+    return -1;
+  }
+  double scaled = static_cast<double>(cycles) *
+                  static_cast<double>(enabled_ns) /
+                  static_cast<double>(running_ns);
+  return static_cast<long int>(scaled * 1e6 / static_cast<double>(busy_ns) +
+                               0.5);
+}
+
+// Parse the idle time (ns) of each of cpu_ids, counting iowait as idle,
+// from the NUL-terminated text of /proc/stat into idle_ns, which has one
+// entry per cpu. A cpu whose line is missing or cut off reads -1.
+void parse_cpu_idle_ns(const char *stat, const std::vector<int> &cpu_ids,
+                       long long int tick_ns,
+                       std::vector<long long int> &idle_ns) {
+  std::fill(idle_ns.begin(), idle_ns.end(), -1);
+  for (const char *line = stat; std::strncmp(line, "cpu", 3) == 0;) {
+    const char *eol = std::strchr(line, '\n');
+    if (!eol) {
+      break; // Cut off by the end of the buffer.
+    }
+    char *end = nullptr;
+    long int cpu_id = std::strtol(line + 3, &end, 10);
+    if (end != line + 3) { // Not the total over all cpus.
+      // user nice system idle iowait ...
+      long long int ticks[5];
+      int num_ticks = 0;
+      for (const char *p = end; num_ticks < 5; ++num_ticks, p = end) {
+        ticks[num_ticks] = std::strtoll(p, &end, 10);
+        if (end == p || end > eol) {
+          break;
+        }
+      }
+      for (std::size_t i = 0; num_ticks == 5 && i < cpu_ids.size(); ++i) {
+        if (cpu_ids[i] == cpu_id) {
+          idle_ns[i] = (ticks[3] + ticks[4]) * tick_ns;
+        }
+      }
+    }
+    line = eol + 1;
+  }
+}
+
+EffectiveFreqMonitor::EffectiveFreqMonitor()
+    : EffectiveFreqMonitor(get_platform().present_cpu_ids) {}
+
+EffectiveFreqMonitor::EffectiveFreqMonitor(const std::vector<int> &cpu_ids)
+    : cpu_ids_(cpu_ids), fds_(cpu_ids.size(), -1),
+      cycles_(cpu_ids.size(), 0), enabled_ns_(cpu_ids.size(), 0),
+      running_ns_(cpu_ids.size(), 0), idle_ns_(cpu_ids.size(), -1),
+      freqs_(cpu_ids.size(), -1), busy_us_(cpu_ids.size(), -1),
+      stat_(&attribute("/proc/stat")), stat_idle_(cpu_ids.size(), -1),
+      tick_ns_(1000000000LL / sysconf(_SC_CLK_TCK)) {
+  // Room for the total line and one per cpu up to the highest measured.
+  int max_cpu_id = 0;
+  for (int cpu_id : cpu_ids_) {
+    max_cpu_id = std::max(max_cpu_id, cpu_id);
+  }
+  stat_buf_.resize(128 * (max_cpu_id + 2));
+
+  int err = ENODEV;
+  bool opened = false;
+  for (std::size_t i = 0; i < cpu_ids_.size(); ++i) {
+    fds_[i] = open_cycle_counter(cpu_ids_[i]);
+    if (fds_[i] < 0) {
+      err = errno;
+    } else {
+      opened = true;
+    }
+  }
+  if (!opened) {
+    throw JetsonClocksException(
+        std::string("cannot open cpu cycle counters: ") + std::strerror(err));
+  }
+  read_counters();
+}
+
+EffectiveFreqMonitor::~EffectiveFreqMonitor() {
+  for (int fd : fds_) {
+    if (fd >= 0) {
+      close(fd);
+    }
+  }
+}
+
+void EffectiveFreqMonitor::read_counters() {
+  long int n = stat_->read(stat_buf_.data(), stat_buf_.size() - 1);
+  stat_buf_[n < 0 ? 0 : n] = '\0';
+  parse_cpu_idle_ns(stat_buf_.data(), cpu_ids_, tick_ns_, stat_idle_);
+  const std::vector<long long int> &idle_ns = stat_idle_;
+  for (std::size_t i = 0; i < fds_.size(); ++i) {
+    // value, time enabled, time running
+    unsigned long long int values[3];
+    if (fds_[i] < 0 ||
+        read(fds_[i], values, sizeof(values)) != sizeof(values)) {
+      freqs_[i] = -1;
+      busy_us_[i] = -1;
+      continue;
+    }
+    // A cpu-wide counter stays enabled through idle, so the enabled time is
+    // the interval. The idle ticks only roughly line up with it.
+    long long int enabled_ns = values[1] - enabled_ns_[i];
+    long long int busy_ns = -1;
+    if (idle_ns[i] >= 0 && idle_ns_[i] >= 0) {
+      busy_ns = std::min(std::max(enabled_ns - (idle_ns[i] - idle_ns_[i]),
+                                  0LL),
+                         enabled_ns);
+    }
+    freqs_[i] = effective_freq_khz(values[0] - cycles_[i], enabled_ns,
+                                   values[2] - running_ns_[i], busy_ns);
+    busy_us_[i] = busy_ns < 0 ? -1 : static_cast<long int>(busy_ns / 1000);
+    cycles_[i] = values[0];
+    enabled_ns_[i] = values[1];
+    running_ns_[i] = values[2];
+    idle_ns_[i] = idle_ns[i];
+  }
+}
+
+std::vector<long int> EffectiveFreqMonitor::sample() {
+  read_counters();
+  return freqs_;
+}
+
+void EffectiveFreqMonitor::sample(Snapshot &snap) {
+  read_counters();
+  for (int slot = 0; slot < snap.num_cpus; ++slot) {
+    CpuSnapshot &cpu = snap.cpus[slot];
+    for (std::size_t i = 0; i < cpu_ids_.size(); ++i) {
+      if (cpu_ids_[i] == cpu.cpu_id) {
+        cpu.effective_freq = freqs_[i];
+        cpu.busy_us = busy_us_[i];
+      }
+    }
+  }
+}
+
+long int get_cpu_effective_freq(int cpu_id, long int interval_us) {
+  EffectiveFreqMonitor monitor(std::vector<int>{cpu_id});
+  usleep(interval_us);
+  long int freq = monitor.sample()[0];
+  if (freq < 0) {
+    throw JetsonClocksException("cannot measure the effective freq of cpu" +
+                                to_string(cpu_id) +
+                                ", it stayed idle or its counter failed.");
+  }
+  return freq;
+}
+
+Watcher::Watcher(int min_interval_ms, int max_interval_ms)
+    : min_interval_ms_(min_interval_ms), max_interval_ms_(max_interval_ms),
+      epoll_fd_(epoll_create1(EPOLL_CLOEXEC)),
+      stop_fd_(eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)), stopped_(false),
+      waiting_(0), alive_(std::make_shared<bool>(true)) {
+  if (epoll_fd_ < 0 || stop_fd_ < 0) {
+    int err = errno;
+    if (epoll_fd_ >= 0) {
+      close(epoll_fd_);
+    }
+    if (stop_fd_ >= 0) {
+      close(stop_fd_);
+    }
+    throw JetsonClocksException(std::string("cannot create watcher: ") +
+                                std::strerror(err));
+  }
+  struct epoll_event ev;
+  ev.events = EPOLLIN;
+  ev.data.ptr = nullptr;
+  epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, stop_fd_, &ev);
+}
+
+Watcher::~Watcher() {
+  *alive_ = false;
+  for (const auto &entry : entries_) {
+    if (entry->fd >= 0) {
+      close(entry->fd);
+    }
+  }
+  close(stop_fd_);
+  close(epoll_fd_);
+}
+
+void Watcher::watch(const std::string &path, Callback callback) {
+  // Each watch has its own descriptor. sysfs tracks notifications per open
+  // file, so a read through the shared Attribute handle would swallow them.
+  int fd = open(resolve_path(path).c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    throw JetsonClocksException("cannot watch " + path + ": " +
+                                std::strerror(errno));
+  }
+
+  std::unique_ptr<Entry> entry(new Entry());
+  entry->path = path;
+  entry->callback = callback;
+  entry->fd = fd;
+  entry->notified = false;
+  entry->interval_ms = min_interval_ms_;
+  entry->next_ns = monotonic_ns();
+
+  // sysfs only reports POLLPRI for changes after the file has been read.
+  char buf[4096];
+  ssize_t n = pread(fd, buf, sizeof(buf), 0);
+  if (n > 0) {
+    entry->value = strip_newline(std::string(buf, n));
+  }
+
+  // Regular files (and so fake trees) cannot be registered with epoll, so
+  // they are only ever polled.
+  struct epoll_event ev;
+  ev.events = EPOLLPRI;
+  ev.data.ptr = entry.get();
+  epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &ev);
+
+  entries_.push_back(std::move(entry));
+}
+
+void Watcher::unwatch(const std::string &path) {
+  for (const auto &entry : entries_) {
+    if (entry->path == path && entry->fd >= 0) {
+      epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, entry->fd, nullptr);
+      close(entry->fd);
+      entry->fd = -1;
+    }
+  }
+  // wait() may still hold the entry, so it frees it when it is done.
+  if (waiting_ == 0) {
+    remove_unwatched();
+  }
+}
+
+void Watcher::remove_unwatched() {
+  entries_.erase(std::remove_if(entries_.begin(), entries_.end(),
+                                [](const std::unique_ptr<Entry> &entry) {
+                                  return entry->fd < 0;
+                                }),
+                 entries_.end());
+}
+
+int Watcher::poll_interval_ms(const std::string &path) const {
+  for (const auto &entry : entries_) {
+    if (entry->path == path && entry->fd >= 0) {
+      return entry->notified ? -1 : entry->interval_ms;
+    }
+  }
+  throw JetsonClocksException(path + " is not watched.");
+}
+
+int Watcher::check(Entry &entry) {
+  char buf[4096];
+  ssize_t n;
+  do {
+    n = pread(entry.fd, buf, sizeof(buf), 0);
+  } while (n < 0 && errno == EINTR);
+  if (n < 0) {
+    return 0;
+  }
+  std::size_t len = static_cast<std::size_t>(n);
+  while (len > 0 && buf[len - 1] == '\n') {
+    --len;
+  }
+  if (entry.value.compare(0, std::string::npos, buf, len) == 0) {
+    return 0;
+  }
+  entry.value.assign(buf, len);
+  entry.callback(entry.path, entry.value);
+  return 1;
+}
+
+int Watcher::wait(int timeout_ms) {
+  long long int now = monotonic_ns();
+  long long int deadline =
+      timeout_ms < 0 ? -1 : now + timeout_ms * 1000000LL;
+  // A callback can destroy the watcher, after which nothing of it may be
+  // touched, or watch and unwatch, so entries are walked by index and only
+  // freed between passes.
+  std::shared_ptr<bool> alive = alive_;
+  ++waiting_;
+
+  for (;;) {
+    // Sleep until the next poll is due, the timeout expires, or a
+    // notification arrives.
+    long long int wake = deadline;
+    for (const auto &entry : entries_) {
+      if (entry->fd >= 0 && !entry->notified &&
+          (wake < 0 || entry->next_ns < wake)) {
+        wake = entry->next_ns;
+      }
+    }
+    int wait_ms = -1;
+    if (wake >= 0) {
+      wait_ms = wake <= now ? 0
+                            : static_cast<int>((wake - now + 999999) / 1000000);
+    }
+
+    struct epoll_event events[16];
+    int n = epoll_wait(epoll_fd_, events, 16, wait_ms);
+    if (n < 0 && errno != EINTR) {
+      --waiting_;
+      throw JetsonClocksException(std::string("cannot wait for changes: ") +
+                                  std::strerror(errno));
+    }
+
+    int callbacks = 0;
+    for (int i = 0; i < n; ++i) {
+      Entry *entry = static_cast<Entry *>(events[i].data.ptr);
+      if (!entry) {
+        std::uint64_t count;
+        ssize_t ignored = read(stop_fd_, &count, sizeof(count));
+        (void)ignored;
+        continue;
+      }
+      if (entry->fd < 0) {
+        continue; // Unwatched by an earlier callback.
+      }
+      entry->notified = true;
+      callbacks += check(*entry);
+      if (!*alive) {
+        return callbacks;
+      }
+    }
+
+    now = monotonic_ns();
+    for (std::size_t i = 0; i < entries_.size(); ++i) {
+      Entry &entry = *entries_[i];
+      if (entry.fd < 0 || entry.notified || entry.next_ns > now) {
+        continue;
+      }
+      int changed = check(entry);
+      if (!*alive) {
+        return callbacks + changed;
+      }
+      callbacks += changed;
+      if (changed) {
+        entry.interval_ms = min_interval_ms_;
+      } else {
+        entry.interval_ms = std::min(entry.interval_ms * 2, max_interval_ms_);
+      }
+      entry.next_ns = now + entry.interval_ms * 1000000LL;
+    }
+    if (waiting_ == 1) {
+      remove_unwatched();
+    }
+
+    if (callbacks > 0 || stopped_ || (deadline >= 0 && now >= deadline)) {
+      --waiting_;
+      return callbacks;
+    }
+  }
+}
+
+void Watcher::run() {
+  while (!stopped_) {
+    wait(-1);
+  }
+}
+
+void Watcher::stop() {
+  stopped_ = true;
+  std::uint64_t one = 1;
+  ssize_t ignored = write(stop_fd_, &one, sizeof(one));
+  (void)ignored;
+}
+
+Sampler::Sampler(const SamplerOptions &options)
+    : options_(options), ring_(options.capacity), timer_fd_(-1),
+      stop_fd_(-1), ticks_(0), overruns_(0), dropped_(0), max_jitter_ns_(0),
+      total_jitter_ns_(0) {
+  if (!running_as_root()) {
+    throw JetsonClocksException(
+        "cannot create a sampler without root permissions.");
+  }
+  if (options.paths.size() > JETSON_CLOCKS_MAX_SAMPLE_VALUES) {
+    throw JetsonClocksException(
+        "a sampler reads at most " + to_string(JETSON_CLOCKS_MAX_SAMPLE_VALUES) +
+        " attributes.");
+  }
+  if (options.period_us <= 0) {
+    throw JetsonClocksException("sampler period must be positive.");
+  }
+
+  std::vector<Attribute *> attrs;
+  for (const std::string &path : options.paths) {
+    attrs.push_back(&attribute(path));
+  }
+  batch_.reset(new ReadBatch(attrs, options.backend));
+
+  timer_fd_ = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+  stop_fd_ = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  if (timer_fd_ < 0 || stop_fd_ < 0) {
+    int err = errno;
+    if (timer_fd_ >= 0) {
+      close(timer_fd_);
+    }
+    if (stop_fd_ >= 0) {
+      close(stop_fd_);
+    }
+    throw JetsonClocksException(std::string("cannot create sampler: ") +
+                                std::strerror(err));
+  }
+}
+
+Sampler::~Sampler() {
+  stop();
+  close(timer_fd_);
+  close(stop_fd_);
+}
+
+void Sampler::start() {
+  if (thread_.joinable()) {
+    return;
+  }
+  std::uint64_t count;
+  ssize_t ignored = read(stop_fd_, &count, sizeof(count));
+  (void)ignored;
+
+  // The thread reports whether it got its cpu and priority before it arms
+  // the timer, so no tick is ever taken with the wrong scheduling.
+  std::promise<int> started;
+  std::future<int> result = started.get_future();
+  thread_ = std::thread(&Sampler::run, this, std::ref(started));
+  int err = result.get();
+  if (err != 0) {
+    thread_.join();
+    throw JetsonClocksException(std::string("cannot start sampler: ") +
+                                std::strerror(err));
+  }
+}
+
+// Pin the calling thread and give it its real-time priority, as the options
+// ask. Returns 0 or an errno.
+int Sampler::set_scheduling() const {
+  int err = 0;
+  if (options_.cpu >= 0) {
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(options_.cpu, &cpus);
+    err = pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+  }
+  if (err == 0 && options_.fifo_priority > 0) {
+    struct sched_param param;
+    param.sched_priority = options_.fifo_priority;
+    err = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+  }
+  return err;
+}
+
+void Sampler::stop() {
+  if (!thread_.joinable()) {
+    return;
+  }
+  std::uint64_t one = 1;
+  ssize_t ignored = write(stop_fd_, &one, sizeof(one));
+  (void)ignored;
+  thread_.join();
+}
+
+SamplerStats Sampler::stats() const {
+  SamplerStats stats;
+  stats.ticks = ticks_;
+  stats.overruns = overruns_;
+  stats.dropped = dropped_;
+  stats.max_jitter_ns = max_jitter_ns_;
+  stats.mean_jitter_ns = stats.ticks ? total_jitter_ns_ / stats.ticks : 0;
+  return stats;
+}
+
+void Sampler::run(std::promise<int> &started) {
+  int err = set_scheduling();
+  if (err != 0) {
+    started.set_value(err);
+    return;
+  }
+
+  const long long int period_ns = options_.period_us * 1000LL;
+  const long long int start_ns = monotonic_ns() + period_ns;
+
+  // An absolute first expiry and a fixed interval keep the ticks on a
+  // grid, however long each one takes.
+  struct itimerspec spec;
+  spec.it_value.tv_sec = start_ns / 1000000000;
+  spec.it_value.tv_nsec = start_ns % 1000000000;
+  spec.it_interval.tv_sec = period_ns / 1000000000;
+  spec.it_interval.tv_nsec = period_ns % 1000000000;
+  if (timerfd_settime(timer_fd_, TFD_TIMER_ABSTIME, &spec, nullptr) != 0) {
+    started.set_value(errno);
+    return;
+  }
+  started.set_value(0);
+
+  unsigned long long int tick = 0;
+  struct pollfd fds[2] = {{timer_fd_, POLLIN, 0}, {stop_fd_, POLLIN, 0}};
+  for (;;) {
+    if (poll(fds, 2, -1) < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      break;
+    }
+    if (fds[1].revents) {
+      break;
+    }
+    std::uint64_t expirations = 0;
+    if (read(timer_fd_, &expirations, sizeof(expirations)) !=
+            sizeof(expirations) ||
+        expirations == 0) {
+      continue;
+    }
+    tick += expirations;
+    overruns_ += expirations - 1;
+
+    Sample sample;
+    sample.tick = tick;
+    sample.time_ns = monotonic_ns();
+    sample.jitter_ns = sample.time_ns - (start_ns + (tick - 1) * period_ns);
+    batch_->read_all();
+    sample.num_values = static_cast<int>(batch_->size());
+    for (std::size_t i = 0; i < batch_->size(); ++i) {
+      sample.values[i] = parse_long(batch_->data(i), batch_->result(i));
+    }
+    if (!ring_.push(sample)) {
+      ++dropped_;
+    }
+
+    ++ticks_;
+    total_jitter_ns_ += sample.jitter_ns;
+    if (sample.jitter_ns > max_jitter_ns_) {
+      max_jitter_ns_ = sample.jitter_ns;
+    }
+  }
+
+  struct itimerspec disarm = {};
+  timerfd_settime(timer_fd_, 0, &disarm, nullptr);
+}
+
+// Where the readings of one rail are in a Sample: its power, or, for
+// drivers without a power attribute, its voltage followed by its current.
+struct RailValues {
+  int index;
+  bool computed;
+};
+
+// Integrates the power of every rail over [start_ns, end_ns] from readings
+// that arrive in time order, interpolating linearly between them.
+struct EnergyIntegrator {
+  long long int start_ns = 0;
+  long long int end_ns = 0;
+  long long int last_ns = -1;
+  std::vector<double> last_mw;
+  std::vector<double> energy_mj;
+
+  void add(long long int time_ns, const std::vector<double> &mw) {
+    if (time_ns < last_ns) {
+      return; // Taken before the run started.
+    }
+    if (last_ns >= 0 && time_ns > last_ns) {
+      long long int lo = std::max(last_ns, start_ns);
+      long long int hi = std::min(time_ns, end_ns);
+      double span = static_cast<double>(time_ns - last_ns);
+      for (std::size_t i = 0; lo < hi && i < mw.size(); ++i) {
+        double slope = (mw[i] - last_mw[i]) / span;
+        double lo_mw = last_mw[i] + slope * (lo - last_ns);
+        double hi_mw = last_mw[i] + slope * (hi - last_ns);
+        energy_mj[i] += (lo_mw + hi_mw) / 2 * (hi - lo) * 1e-9;
+      }
+    }
+    last_ns = time_ns;
+    last_mw = mw;
+  }
+};
+
+// Convert the rail values of a reading to mW. A rail that could not be
+// read keeps its previous power.
+void rail_power(const std::vector<RailValues> &rails, const long int *values,
+                std::vector<double> &mw) {
+  for (std::size_t i = 0; i < rails.size(); ++i) {
+    const RailValues &rail = rails[i];
+    long int power = values[rail.index];
+    if (rail.computed) {
+      long int current = values[rail.index + 1];
+      power = power < 0 || current < 0 ? -1 : power * current / 1000;
+    }
+    if (power >= 0) {
+      mw[i] = static_cast<double>(power);
+    }
+  }
+}
+
+void drain_energy_samples(Sampler &sampler,
+                          const std::vector<RailValues> &rails,
+                          EnergyIntegrator &integrator,
+                          std::vector<double> &mw,
+                          unsigned long long int &samples) {
+  Sample sample;
+  while (sampler.pop(sample)) {
+    rail_power(rails, sample.values, mw);
+    integrator.add(sample.time_ns, mw);
+    ++samples;
+  }
+}
+
+EnergyReport measure_energy(const std::function<void()> &callable,
+                            int iterations, const EnergyOptions &options) {
+  if (!running_as_root()) {
+    throw JetsonClocksException(
+        "cannot measure energy without root permissions.");
+  }
+  if (iterations <= 0) {
+    throw JetsonClocksException("energy iterations must be positive.");
+  }
+
+  const Platform &platform = get_platform();
+  if (platform.power_rails.empty()) {
+    throw JetsonClocksException(
+        "cannot measure energy because this board has no power rails.");
+  }
+
+  SamplerOptions sampler_options;
+  sampler_options.period_us = options.period_us;
+  sampler_options.capacity = options.capacity;
+  sampler_options.cpu = options.cpu;
+  std::vector<RailValues> rails;
+  for (const PowerRailAttributes &attrs : platform.power_rail_attrs) {
+    rails.push_back(RailValues{static_cast<int>(sampler_options.paths.size()),
+                               attrs.power == nullptr});
+    if (attrs.power) {
+      sampler_options.paths.push_back(attrs.power->path());
+    } else {
+      sampler_options.paths.push_back(attrs.voltage->path());
+      sampler_options.paths.push_back(attrs.current->path());
+    }
+  }
+  Sampler sampler(sampler_options);
+
+  EnergyReport report;
+  report.iterations = iterations;
+  report.samples = 0;
+  report.clocks = read_profile();
+
+  // The same attributes the sampler reads, for the readings at either end.
+  std::vector<Attribute *> attrs;
+  for (const std::string &path : sampler_options.paths) {
+    attrs.push_back(&attribute(path));
+  }
+  ReadBatch batch(attrs, ReadBackend::pread);
+  std::vector<long int> values(attrs.size());
+  auto read_directly = [&](std::vector<double> &mw) {
+    batch.read_all();
+    for (std::size_t i = 0; i < attrs.size(); ++i) {
+      values[i] = parse_long(batch.data(i), batch.result(i));
+    }
+    rail_power(rails, values.data(), mw);
+  };
+
+  EnergyIntegrator integrator;
+  std::vector<double> mw(rails.size(), 0.0);
+  integrator.energy_mj.assign(rails.size(), 0.0);
+  integrator.end_ns = std::numeric_limits<long long int>::max();
+
+  sampler.start();
+  read_directly(mw);
+  integrator.start_ns = monotonic_ns();
+  integrator.add(integrator.start_ns, mw);
+  for (int i = 0; i < iterations; ++i) {
+    callable();
+    // Draining between calls keeps the buffer from filling on long runs.
+    drain_energy_samples(sampler, rails, integrator, mw, report.samples);
+  }
+  long long int end_ns = monotonic_ns();
+  std::vector<double> end_mw = mw;
+  read_directly(end_mw);
+  sampler.stop();
+
+  // Readings taken after the last call only bound the final interval, which
+  // the direct reading closes unless one of them already has.
+  integrator.end_ns = end_ns;
+  drain_energy_samples(sampler, rails, integrator, mw, report.samples);
+  integrator.add(std::max(end_ns, integrator.last_ns), end_mw);
+  report.dropped = sampler.stats().dropped;
+
+  double seconds = (end_ns - integrator.start_ns) * 1e-9;
+  report.wall_time_s = seconds;
+  report.time_per_iteration_s = seconds / iterations;
+  for (std::size_t i = 0; i < rails.size(); ++i) {
+    RailEnergy energy;
+    energy.rail = platform.power_rails[i];
+    energy.energy_j = integrator.energy_mj[i] / 1000;
+    energy.energy_per_iteration_j = energy.energy_j / iterations;
+    energy.average_power_mw =
+        seconds > 0 ? integrator.energy_mj[i] / seconds : 0.0;
+    report.rails.push_back(energy);
+  }
+  return report;
+}
+
+// Telemetry segment layout: a header, then capacity slots. Slot i holds
+// publication n when n % capacity == i and its sequence is 2 * n + 2; the
+// sequence is odd while the slot is being written.
+const std::uint32_t telemetry_magic = 0x4a43544d; // "JCTM"
+const std::uint32_t telemetry_version = 2;
+
+struct TelemetryHeader {
+  std::atomic<std::uint32_t> magic; // Stored last, once the header is valid.
+  std::uint32_t version;
+  std::uint32_t snapshot_size;
+  std::uint32_t capacity;
+  std::atomic<std::uint64_t> published;
+  std::int32_t publisher_pid;
+};
+
+struct TelemetrySlot {
+  std::atomic<std::uint64_t> sequence;
+  Snapshot snapshot;
+};
+
+std::string telemetry_shm_name(const std::string &name) {
+  return name.empty() || name[0] != '/' ? "/" + name : name;
+}
+
+TelemetryHeader *telemetry_header(void *map) {
+  return static_cast<TelemetryHeader *>(map);
+}
+
+TelemetrySlot *telemetry_slots(void *map) {
+  return reinterpret_cast<TelemetrySlot *>(static_cast<char *>(map) +
+                                           sizeof(TelemetryHeader));
+}
+
+std::size_t telemetry_map_size(std::size_t capacity) {
+  return sizeof(TelemetryHeader) + capacity * sizeof(TelemetrySlot);
+}
+
+// The pid of the process publishing into an existing segment, or 0 if the
+// segment has no valid header or the process that created it is gone.
+pid_t live_telemetry_publisher(const std::string &shm_name) {
+  int fd = shm_open(shm_name.c_str(), O_RDONLY, 0);
+  if (fd < 0) {
+    return 0;
+  }
+  struct stat st;
+  void *map = MAP_FAILED;
+  if (fstat(fd, &st) == 0 &&
+      static_cast<std::size_t>(st.st_size) >= sizeof(TelemetryHeader)) {
+    map = mmap(nullptr, sizeof(TelemetryHeader), PROT_READ, MAP_SHARED, fd, 0);
+  }
+  close(fd);
+  if (map == MAP_FAILED) {
+    return 0;
+  }
+  TelemetryHeader *header = telemetry_header(map);
+  pid_t pid = 0;
+  if (header->magic.load(std::memory_order_acquire) == telemetry_magic &&
+      header->version == telemetry_version) {
+    pid = header->publisher_pid;
+  }
+  munmap(map, sizeof(TelemetryHeader));
+  if (pid > 0 && kill(pid, 0) != 0 && errno == ESRCH) {
+    pid = 0;
+  }
+  return pid;
+}
+
+// How many times a reader tries a slot that is mid-write, or the newest
+// publication, before giving up. A write takes a memcpy, so only a
+// publisher that died mid-write exhausts this.
+const int telemetry_read_attempts = 1000;
+
+// Copy publication n out of the ring. Returns false if the slot already
+// holds a later publication, or is still being written after
+// telemetry_read_attempts tries.
+bool read_telemetry_slot(void *map, std::uint64_t n, Snapshot &out) {
+  TelemetryHeader *header = telemetry_header(map);
+  TelemetrySlot &slot = telemetry_slots(map)[n % header->capacity];
+  for (int attempt = 0; attempt < telemetry_read_attempts; ++attempt) {
+    std::uint64_t before = slot.sequence.load(std::memory_order_acquire);
+    if (before != 2 * n + 2) {
+      if (before == 2 * n + 1) {
+        std::this_thread::yield(); // Being written right now.
+        continue;
+      }
+      return false;
+    }
+    std::memcpy(&out, &slot.snapshot, sizeof(Snapshot));
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (slot.sequence.load(std::memory_order_relaxed) == before) {
+      return true;
+    }
+  }
+  return false;
+}
+
+TelemetryPublisher::TelemetryPublisher(const std::string &name,
+                                       std::size_t history)
+    : name_(telemetry_shm_name(name)), map_(nullptr), map_size_(0),
+      stop_fd_(-1) {
+  if (!running_as_root()) {
+    throw JetsonClocksException(
+        "cannot publish telemetry without root permissions.");
+  }
+  history = std::max<std::size_t>(history, 1);
+  map_size_ = telemetry_map_size(history);
+
+  // The segment is always created afresh: resizing one that readers have
+  // mapped would fault them. One left over from a publisher that did not
+  // exit cleanly is unlinked first, so readers still attached to it keep
+  // their mapping of the old one.
+  int fd = shm_open(name_.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+  if (fd < 0 && errno == EEXIST) {
+    pid_t pid = live_telemetry_publisher(name_);
+    if (pid != 0) {
+      throw JetsonClocksException("telemetry segment " + name_ +
+                                  " is in use by process " + to_string(pid) +
+                                  ".");
+    }
+    shm_unlink(name_.c_str());
+    fd = shm_open(name_.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+  }
+  if (fd < 0) {
+    throw JetsonClocksException("cannot create telemetry segment " + name_ +
+                                ": " + std::strerror(errno));
+  }
+  if (ftruncate(fd, map_size_) != 0) {
+    int err = errno;
+    close(fd);
+    shm_unlink(name_.c_str());
+    throw JetsonClocksException("cannot size telemetry segment " + name_ +
+                                ": " + std::strerror(err));
+  }
+  void *map =
+      mmap(nullptr, map_size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  int err = errno;
+  close(fd);
+  if (map == MAP_FAILED) {
+    shm_unlink(name_.c_str());
+    throw JetsonClocksException("cannot map telemetry segment " + name_ +
+                                ": " + std::strerror(err));
+  }
+  map_ = map;
+  stop_fd_ = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  if (stop_fd_ < 0) {
+    err = errno;
+    munmap(map_, map_size_);
+    shm_unlink(name_.c_str());
+    throw JetsonClocksException(
+        std::string("cannot create telemetry publisher: ") +
+        std::strerror(err));
+  }
+
+  // A new segment is zeroed, and a zero sequence matches no publication.
+  TelemetryHeader *header = telemetry_header(map_);
+  header->version = telemetry_version;
+  header->publisher_pid = getpid();
+  header->snapshot_size = sizeof(Snapshot);
+  header->capacity = static_cast<std::uint32_t>(history);
+  header->published.store(0, std::memory_order_relaxed);
+  header->magic.store(telemetry_magic, std::memory_order_release);
+}
+
+TelemetryPublisher::~TelemetryPublisher() {
+  stop();
+  close(stop_fd_);
+  munmap(map_, map_size_);
+  shm_unlink(name_.c_str());
+}
+
+void TelemetryPublisher::publish() {
+  Snapshot snap;
+  snapshot(snap);
+  publish(snap);
+}
+
+void TelemetryPublisher::publish(const Snapshot &snap) {
+  TelemetryHeader *header = telemetry_header(map_);
+  std::uint64_t n = header->published.load(std::memory_order_relaxed);
+  TelemetrySlot &slot = telemetry_slots(map_)[n % header->capacity];
+
+  slot.sequence.store(2 * n + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  std::memcpy(&slot.snapshot, &snap, sizeof(Snapshot));
+  slot.sequence.store(2 * n + 2, std::memory_order_release);
+  header->published.store(n + 1, std::memory_order_release);
+}
+
+void TelemetryPublisher::start(long int period_us) {
+  if (thread_.joinable()) {
+    return;
+  }
+  if (period_us <= 0) {
+    throw JetsonClocksException("telemetry period must be positive.");
+  }
+  std::uint64_t count;
+  ssize_t ignored = read(stop_fd_, &count, sizeof(count));
+  (void)ignored;
+  thread_ = std::thread(&TelemetryPublisher::run, this, period_us);
+}
+
+void TelemetryPublisher::stop() {
+  if (!thread_.joinable()) {
+    return;
+  }
+  std::uint64_t one = 1;
+  ssize_t ignored = write(stop_fd_, &one, sizeof(one));
+  (void)ignored;
+  thread_.join();
+}
+
+unsigned long long int TelemetryPublisher::published() const {
+  return telemetry_header(map_)->published.load(std::memory_order_acquire);
+}
+
+void TelemetryPublisher::run(long int period_us) {
+  // Sleep on the stop descriptor until the next absolute deadline, so
+  // publications do not drift and stop() wakes the thread at once.
+  const long long int period_ns = period_us * 1000LL;
+  long long int next_ns = monotonic_ns();
+  struct pollfd fds[1] = {{stop_fd_, POLLIN, 0}};
+  for (;;) {
+    try {
+      publish();
+    } catch (JetsonClocksException &) {
+      // A failed snapshot is skipped; the next period tries again.
+    }
+    next_ns += period_ns;
+    long long int now = monotonic_ns();
+    if (next_ns < now) {
+      next_ns = now; // Fell behind; publish again straight away.
+    }
+    int wait_ms = static_cast<int>((next_ns - now + 999999) / 1000000);
+    int n = poll(fds, 1, wait_ms);
+    if (n > 0 || (n < 0 && errno != EINTR)) {
+      break;
+    }
+  }
+}
+
+TelemetryReader::TelemetryReader(const std::string &name)
+    : map_(nullptr), map_size_(0) {
+  std::string shm_name = telemetry_shm_name(name);
+  int fd = shm_open(shm_name.c_str(), O_RDONLY, 0);
+  if (fd < 0) {
+    throw JetsonClocksException("cannot open telemetry segment " + shm_name +
+                                ": " + std::strerror(errno));
+  }
+  struct stat st;
+  void *map = MAP_FAILED;
+  if (fstat(fd, &st) == 0 &&
+      static_cast<std::size_t>(st.st_size) >= sizeof(TelemetryHeader)) {
+    map = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  }
+  close(fd);
+  if (map == MAP_FAILED) {
+    throw JetsonClocksException("cannot map telemetry segment " + shm_name +
+                                ".");
+  }
+  map_ = map;
+  map_size_ = st.st_size;
+
+  TelemetryHeader *header = telemetry_header(map_);
+  const char *problem = nullptr;
+  if (header->magic.load(std::memory_order_acquire) != telemetry_magic) {
+    problem = " is not ready.";
+  } else if (header->version != telemetry_version ||
+             header->snapshot_size != sizeof(Snapshot)) {
+    problem = " has a different snapshot layout.";
+  } else if (header->capacity == 0 ||
+             telemetry_map_size(header->capacity) > map_size_) {
+    problem = " is truncated.";
+  }
+  if (problem) {
+    munmap(map_, map_size_);
+    throw JetsonClocksException("telemetry segment " + shm_name + problem);
+  }
+}
+
+TelemetryReader::~TelemetryReader() { munmap(map_, map_size_); }
+
+bool TelemetryReader::latest(Snapshot &out) const {
+  // A slot is lost to the publisher lapping the whole ring while it is
+  // copied, so look up the newest publication again and retry. If nothing
+  // was published meanwhile, the publisher died mid-write.
+  std::uint64_t published = this->published();
+  for (int attempt = 0; attempt < telemetry_read_attempts; ++attempt) {
+    if (published == 0) {
+      return false;
+    }
+    if (read_telemetry_slot(map_, published - 1, out)) {
+      return true;
+    }
+    std::uint64_t now = this->published();
+    if (now == published) {
+      return false;
+    }
+    published = now;
+  }
+  return false;
+}
+
+std::size_t TelemetryReader::read_since(unsigned long long int &next,
+                                        std::vector<Snapshot> &out) const {
+  std::uint64_t published = this->published();
+  std::uint64_t oldest =
+      published > capacity() ? published - capacity() : 0;
+  std::size_t count = 0;
+  Snapshot snap;
+  for (next = std::max<unsigned long long int>(next, oldest); next < published;
+       ++next) {
+    if (read_telemetry_slot(map_, next, snap)) {
+      out.push_back(snap);
+      ++count;
+    }
+  }
+  return count;
+}
+
+unsigned long long int TelemetryReader::published() const {
+  return telemetry_header(map_)->published.load(std::memory_order_acquire);
+}
+
+std::size_t TelemetryReader::capacity() const {
+  return telemetry_header(map_)->capacity;
+}
+
+FanController::FanController(const FanControllerOptions &options)
+    : options_(options), pwm_(0), writes_(0),
+      curve_temp_mc_(std::numeric_limits<long int>::min()), integral_(0),
+      last_error_(0), last_tick_ns_(0), stop_fd_(-1) {
+  if (!running_as_root()) {
+    throw JetsonClocksException(
+        "cannot control the fan without root permissions.");
+  }
+
+  const Platform &platform = get_platform();
+  if (platform.fan_always_on || !platform.fan_pwm) {
+    throw JetsonClocksException("fan speed file not found.");
+  }
+  if (options.min_pwm < 0 || options.max_pwm > 255 ||
+      options.min_pwm > options.max_pwm) {
+    throw JetsonClocksException("fan pwm limits must be between 0 and 255.");
+  }
+  if (options.max_step <= 0 || options.period_ms <= 0) {
+    throw JetsonClocksException("fan step and period must be positive.");
+  }
+  if (options.mode == FanMode::curve) {
+    if (options.curve.empty()) {
+      throw JetsonClocksException("fan curve has no points.");
+    }
+    for (std::size_t i = 1; i < options.curve.size(); ++i) {
+      if (options.curve[i].temp_mc <= options.curve[i - 1].temp_mc) {
+        throw JetsonClocksException(
+            "fan curve temperatures must be ascending.");
+      }
+    }
+  }
+
+  std::vector<Attribute *> temps;
+  if (options.zones.empty()) {
+    temps = platform.thermal_zone_temps;
+  }
+  for (const std::string &zone : options.zones) {
+    temps.push_back(platform.thermal_zone_temps[get_thermal_zone_index(zone)]);
+  }
+  if (temps.empty()) {
+    throw JetsonClocksException(
+        "cannot control the fan because this board has no thermal zones.");
+  }
+  batch_.reset(new ReadBatch(temps, ReadBackend::pread));
+
+  // Slewing starts from the speed the fan already has.
+  long int current = read_current_long(platform.fan_pwm, options.min_pwm);
+  pwm_ = static_cast<int>(std::min<long int>(
+      std::max<long int>(current, options.min_pwm), options.max_pwm));
+
+  stop_fd_ = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  if (stop_fd_ < 0) {
+    throw JetsonClocksException(std::string("cannot create fan controller: ") +
+                                std::strerror(errno));
+  }
+}
+
+FanController::~FanController() {
+  stop();
+  close(stop_fd_);
+}
+
+int FanController::target_pwm(long int temp_mc, long long int now_ns) {
+  const FanControllerOptions &o = options_;
+  double output;
+  if (o.mode == FanMode::curve) {
+    // Follow rising temperatures at once, but falling ones only once they
+    // leave the hysteresis band.
+    if (temp_mc > curve_temp_mc_) {
+      curve_temp_mc_ = temp_mc;
+    } else if (temp_mc < curve_temp_mc_ - o.hysteresis_mc) {
+      curve_temp_mc_ = temp_mc + o.hysteresis_mc;
+    }
+    const std::vector<FanCurvePoint> &curve = o.curve;
+    if (curve_temp_mc_ <= curve.front().temp_mc) {
+      output = curve.front().pwm;
+    } else if (curve_temp_mc_ >= curve.back().temp_mc) {
+      output = curve.back().pwm;
+    } else {
+      std::size_t i = 1;
+      while (curve[i].temp_mc < curve_temp_mc_) {
+        ++i;
+      }
+      const FanCurvePoint &lo = curve[i - 1];
+      const FanCurvePoint &hi = curve[i];
+      output = lo.pwm + static_cast<double>(hi.pwm - lo.pwm) *
+                            (curve_temp_mc_ - lo.temp_mc) /
+                            (hi.temp_mc - lo.temp_mc);
+    }
+  } else {
+    double error = (temp_mc - o.target_mc) / 1000.0;
+    double dt = last_tick_ns_ ? (now_ns - last_tick_ns_) * 1e-9 : 0.0;
+    double derivative = dt > 0 ? (error - last_error_) / dt : 0.0;
+    double integral = integral_ + error * dt;
+    output = o.kp * error + o.ki * integral + o.kd * derivative;
+    // Stop integrating while the output is pinned at a limit, so the loop
+    // does not wind up.
+    bool saturated = (output >= o.max_pwm && error > 0) ||
+                     (output <= o.min_pwm && error < 0);
+    if (!saturated) {
+      integral_ = integral;
+    }
+    output = o.kp * error + o.ki * integral_ + o.kd * derivative;
+    last_error_ = error;
+  }
+  long int pwm = std::lround(output);
+  return static_cast<int>(
+      std::min<long int>(std::max<long int>(pwm, o.min_pwm), o.max_pwm));
+}
+
+int FanController::tick() {
+  batch_->read_all();
+  long int temp_mc = std::numeric_limits<long int>::min();
+  for (std::size_t i = 0; i < batch_->size(); ++i) {
+    long int n = batch_->result(i);
+    if (n > 0) {
+      temp_mc = std::max(temp_mc, parse_long(batch_->data(i), n));
+    }
+  }
+  if (temp_mc == std::numeric_limits<long int>::min()) {
+    throw JetsonClocksException(
+        "cannot control the fan because no thermal zone could be read.");
+  }
+
+  long long int now_ns = monotonic_ns();
+  int target = target_pwm(temp_mc, now_ns);
+  last_tick_ns_ = now_ns;
+
+  int pwm = pwm_;
+  int next = std::min(std::max(target, pwm - options_.max_step),
+                      pwm + options_.max_step);
+  if (next != pwm) {
+    std::lock_guard<std::mutex> lock(get_domain_locks().fan);
+    get_platform().fan_pwm->write_long(next);
+    pwm_ = next;
+    ++writes_;
+  }
+  return next;
+}
+
+void FanController::start() {
+  if (thread_.joinable()) {
+    return;
+  }
+  std::uint64_t count;
+  ssize_t ignored = read(stop_fd_, &count, sizeof(count));
+  (void)ignored;
+  thread_ = std::thread(&FanController::run, this);
+}
+
+void FanController::stop() {
+  if (!thread_.joinable()) {
+    return;
+  }
+  std::uint64_t one = 1;
+  ssize_t ignored = write(stop_fd_, &one, sizeof(one));
+  (void)ignored;
+  thread_.join();
+}
+
+void FanController::run() {
+  struct pollfd fds[1] = {{stop_fd_, POLLIN, 0}};
+  for (;;) {
+    try {
+      tick();
+    } catch (JetsonClocksException &) {
+      // A failed read or write is retried on the next tick.
+    }
+    int n = poll(fds, 1, static_cast<int>(options_.period_ms));
+    if (n > 0 || (n < 0 && errno != EINTR)) {
+      break;
+    }
+  }
 }
 
 } // namespace jetson_clock
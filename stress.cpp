@@ -0,0 +1,172 @@
+#include "fake_tree.hpp"
+#include "jetson_clocks.hpp"
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace jetson_clocks;
+
+// Hammers the library from many threads at once against a fake tree: reader
+// throughput for 1 to 8 threads, then the same readers while writer threads
+// change every clock domain, and finally a check that the board ended up in
+// a valid state.
+namespace {
+
+std::atomic<long int> failures(0);
+
+template <typename F> void guarded(F f) {
+  try {
+    f();
+  } catch (JetsonClocksException &e) {
+    if (failures++ == 0) {
+      std::printf("  first failure: %s\n", e.what());
+    }
+  }
+}
+
+// Run f on each of num_threads threads until stop is set, and return the
+// total number of calls made.
+template <typename F>
+long int run_readers(int num_threads, std::atomic<bool> &stop, F f) {
+  std::atomic<long int> total(0);
+  std::vector<std::thread> threads;
+  for (int t = 0; t < num_threads; ++t) {
+    threads.emplace_back([&] {
+      long int calls = 0;
+      while (!stop) {
+        guarded(f);
+        ++calls;
+      }
+      total += calls;
+    });
+  }
+  for (std::thread &thread : threads) {
+    thread.join();
+  }
+  return total;
+}
+
+template <typename F>
+void measure(const char *name, int num_threads, int duration_ms, F f) {
+  std::atomic<bool> stop(false);
+  std::thread timer([&] {
+    std::this_thread::sleep_for(std::chrono::milliseconds(duration_ms));
+    stop = true;
+  });
+  long int calls = run_readers(num_threads, stop, f);
+  timer.join();
+  std::printf("  %-28s %2d threads %10.2f Mcalls/s\n", name, num_threads,
+              calls / (duration_ms * 1000.0));
+}
+
+void read_cpu_freq() { get_cpu_cur_freq(0); }
+
+void read_snapshot() {
+  Snapshot s;
+  snapshot(s);
+}
+
+// One writer per domain, each cycling between two valid settings.
+std::vector<std::thread> start_writers(std::atomic<bool> &stop) {
+  std::vector<std::thread> writers;
+  for (const CpuCluster &cluster : get_cpu_clusters()) {
+    int policy_id = cluster.policy_id;
+    writers.emplace_back([&stop, policy_id] {
+      for (bool high = false; !stop; high = !high) {
+        guarded([&] {
+          set_cluster_max_freq(policy_id, 2265600);
+          set_cluster_min_freq(policy_id, high ? 2265600 : 1190400);
+          set_cluster_governor(policy_id, high ? "performance" : "schedutil");
+        });
+      }
+    });
+  }
+  writers.emplace_back([&stop] {
+    for (bool high = false; !stop; high = !high) {
+      guarded([&] {
+        set_gpu_freq_range(high ? 1377000000 : 114750000, 1377000000);
+      });
+    }
+  });
+  writers.emplace_back([&stop] {
+    for (bool high = false; !stop; high = !high) {
+      guarded([&] { set_emc_freq(high ? 2133000000 : 204000000); });
+    }
+  });
+  writers.emplace_back([&stop] {
+    for (bool high = false; !stop; high = !high) {
+      guarded([&] { set_fan_speed(high ? 255 : 77); });
+    }
+  });
+  for (int t = 0; t < 2; ++t) {
+    writers.emplace_back([&stop] {
+      while (!stop) {
+        guarded([] { ScopedBoost boost(BoostDomain::gpu | BoostDomain::emc); });
+      }
+    });
+  }
+  return writers;
+}
+
+bool check_final_state() {
+  bool ok = true;
+  for (const CpuCluster &cluster : get_cpu_clusters()) {
+    Span<long int> table = get_cluster_freq_table(cluster.policy_id);
+    long int min_freq = get_cluster_min_freq(cluster.policy_id);
+    long int max_freq = get_cluster_max_freq(cluster.policy_id);
+    if (!table.contains(min_freq) || !table.contains(max_freq) ||
+        min_freq > max_freq) {
+      std::printf("  policy%d has min %ld max %ld\n", cluster.policy_id,
+                  min_freq, max_freq);
+      ok = false;
+    }
+  }
+  Span<long int> gpu_table = get_gpu_freq_table();
+  if (!gpu_table.contains(get_gpu_min_freq()) ||
+      !gpu_table.contains(get_gpu_max_freq())) {
+    std::printf("  gpu has min %ld max %ld\n", get_gpu_min_freq(),
+                get_gpu_max_freq());
+    ok = false;
+  }
+  return ok;
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  int duration_ms = argc > 1 ? std::atoi(argv[1]) : 500;
+
+  std::string root =
+      "/dev/shm/jetson_clocks_stress." + std::to_string(getpid());
+  make_fake_tree(root);
+  set_root_dir(root);
+
+  std::printf("read throughput (%d ms per run)\n", duration_ms);
+  for (int threads = 1; threads <= 8; threads *= 2) {
+    measure("get_cpu_cur_freq()", threads, duration_ms, read_cpu_freq);
+  }
+  for (int threads = 1; threads <= 8; threads *= 2) {
+    measure("snapshot()", threads, duration_ms, read_snapshot);
+  }
+
+  std::printf("read throughput while every domain is written\n");
+  std::atomic<bool> stop_writers(false);
+  std::vector<std::thread> writers = start_writers(stop_writers);
+  for (int threads = 1; threads <= 8; threads *= 2) {
+    measure("get_cpu_cur_freq()", threads, duration_ms, read_cpu_freq);
+  }
+  stop_writers = true;
+  for (std::thread &writer : writers) {
+    writer.join();
+  }
+
+  bool ok = check_final_state() && failures == 0;
+  std::printf("%s, %ld failed calls\n", ok ? "ok" : "FAILED",
+              failures.load());
+  remove_tree(root);
+  return ok ? 0 : 1;
+}
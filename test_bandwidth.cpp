@@ -0,0 +1,54 @@
+#include "test_util.hpp"
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <vector>
+
+using namespace jetson_clocks;
+
+// Checks that an EMC bandwidth table survives a save and load, and that
+// pick_emc_freq() chooses the lowest EMC freq meeting a triad target.
+namespace {
+
+EmcBandwidth row(long int emc_freq, double triad_gbps) {
+  EmcBandwidth r;
+  r.emc_freq = emc_freq;
+  r.copy_gbps = triad_gbps - 1.0;
+  r.scale_gbps = triad_gbps - 2.0;
+  r.triad_gbps = triad_gbps;
+  r.power_mw = emc_freq / 1000000;
+  return r;
+}
+
+void test_bandwidth(const std::string &path) {
+  // Saved out of order: loading sorts by EMC freq.
+  save_emc_bandwidth_table(path, {row(1600000000, 80.5), row(204000000, 11.25),
+                                  row(800000000, 48.0), row(2133000000, 79.0)});
+  std::vector<EmcBandwidth> table = load_emc_bandwidth_table(path);
+  expect_eq("rows", 4, table.size());
+  if (table.size() != 4) {
+    return;
+  }
+  expect_eq("row 0 freq", 204000000, table[0].emc_freq);
+  expect_eq("row 0 triad x100", 1125,
+            static_cast<long int>(table[0].triad_gbps * 100));
+  expect_eq("row 1 copy", 47, static_cast<long int>(table[1].copy_gbps));
+  expect_eq("row 3 power", 2133, static_cast<long int>(table[3].power_mw));
+
+  expect_eq("pick below every row", 204000000, pick_emc_freq(table, 5.0));
+  expect_eq("pick exact", 800000000, pick_emc_freq(table, 48.0));
+  expect_eq("pick between", 1600000000, pick_emc_freq(table, 50.0));
+  // Faster than anything measured: the fastest rate, not the highest.
+  expect_eq("pick unreachable", 1600000000, pick_emc_freq(table, 200.0));
+
+  std::ofstream(path.c_str()) << "204000000 1 2 3 0\n";
+  expect_throws("loading a table without its header",
+                [&] { load_emc_bandwidth_table(path); });
+}
+
+} // namespace
+
+int main() {
+  FakeTree tree("bandwidth");
+  return run_checks([&] { test_bandwidth(tree.root() + "/bandwidth.txt"); });
+}
@@ -0,0 +1,48 @@
+#include "test_util.hpp"
+#include <cstdio>
+#include <string>
+#include <vector>
+
+using namespace jetson_clocks;
+
+// Checks parse_cpu_list() on the lists the kernel writes to
+// /sys/devices/system/cpu/{possible,present,online}, and that malformed
+// input yields no bogus ids.
+namespace {
+
+std::string format(const std::vector<int> &ids) {
+  std::string out = "{";
+  for (std::size_t i = 0; i < ids.size(); ++i) {
+    out += (i ? "," : "") + std::to_string(ids[i]);
+  }
+  return out + "}";
+}
+
+void expect_list(const char *str, const std::vector<int> &expected) {
+  std::vector<int> actual = parse_cpu_list(str);
+  if (actual != expected) {
+    std::printf("FAIL parse_cpu_list(\"%s\"): expected %s, got %s\n", str,
+                format(expected).c_str(), format(actual).c_str());
+    ++failures();
+  }
+}
+
+} // namespace
+
+int main() {
+  expect_list("0-11\n", {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11});
+  expect_list("0,2-3\n", {0, 2, 3});
+  expect_list("5", {5});
+  expect_list("0-1,4-5,10", {0, 1, 4, 5, 10});
+  expect_list("", {});
+  expect_list("\n", {});
+
+  // Malformed lists: stray separators are skipped, and a range that runs
+  // backwards or words that are not numbers add nothing.
+  expect_list("1,,2", {1, 2});
+  expect_list("3-1", {});
+  expect_list("cpu", {});
+  expect_list("x,2", {2});
+
+  return failures() == 0 ? 0 : 1;
+}
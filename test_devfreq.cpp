@@ -0,0 +1,107 @@
+#include "test_util.hpp"
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+using namespace jetson_clocks;
+
+// Checks that the GPU is found through /sys/class/devfreq where the
+// SocTraits paths do not exist (a TX2 whose kernel names the GPU
+// 17000000.gpu rather than 17000000.gp10b), that other devfreq devices are
+// listed and readable by name, and that a SOC no path table knows is
+// rejected by name. The platform is detected once per process, so each case
+// runs in its own process:
+//
+//   jetson_clocks_test_devfreq discover|unknown-soc
+namespace {
+
+void link_devfreq(const std::string &root, const std::string &device_dir,
+                  const std::string &name) {
+  symlink(("../.." + device_dir).c_str(),
+          (root + "/sys/class/devfreq/" + name).c_str());
+}
+
+void make_tx2(const std::string &root) {
+  put(root, "/proc/device-tree/compatible",
+      std::string("nvidia,p3310-1000\0nvidia,tegra186\0", 34));
+  unlink((root + "/sys/class/devfreq/17000000.gv11b").c_str());
+
+  std::string gpu = "/devices/platform/17000000.gpu/devfreq/17000000.gpu";
+  put(root, "/sys" + gpu + "/available_frequencies",
+      "114750000 624750000 930750000 1300500000\n");
+  put(root, "/sys" + gpu + "/min_freq", "114750000\n");
+  put(root, "/sys" + gpu + "/max_freq", "1300500000\n");
+  put(root, "/sys" + gpu + "/cur_freq", "624750000\n");
+  put(root, "/sys" + gpu + "/device/railgate_enable", "1\n");
+  put(root, "/sys" + gpu + "/device/load", "412\n");
+  link_devfreq(root, gpu, "17000000.gpu");
+
+  std::string nvdla = "/devices/15880000.nvdla0/devfreq/15880000.nvdla0";
+  put(root, "/sys" + nvdla + "/min_freq", "115200000\n");
+  put(root, "/sys" + nvdla + "/max_freq", "1369600000\n");
+  put(root, "/sys" + nvdla + "/cur_freq", "115200000\n");
+  link_devfreq(root, nvdla, "15880000.nvdla0");
+}
+
+void test_discover() {
+  std::vector<std::string> devices = get_devfreq_devices();
+  expect_eq("devices", 2, devices.size());
+  if (devices.size() != 2) {
+    return;
+  }
+  expect_eq("device 0", 1, devices[0] == "15880000.nvdla0");
+  expect_eq("device 1", 1, devices[1] == "17000000.gpu");
+
+  expect_eq("gpu cur freq", 624750000, get_gpu_cur_freq());
+  expect_eq("gpu min freq", 114750000, get_gpu_min_freq());
+  expect_eq("gpu max freq", 1300500000, get_gpu_max_speed());
+  expect_eq("gpu freqs", 4, get_gpu_freq_table().size());
+  expect_eq("gpu load", 412, get_gpu_current_usage());
+
+  set_gpu_freq_range(930750000, 1300500000);
+  expect_eq("gpu min after set", 930750000, get_gpu_min_freq());
+  expect_eq("gpu max by name", 1300500000,
+            get_devfreq_max_freq("17000000.gpu"));
+
+  expect_eq("nvdla cur freq", 115200000,
+            get_devfreq_cur_freq("15880000.nvdla0"));
+  expect_eq("nvdla max freq", 1369600000,
+            get_devfreq_max_freq("15880000.nvdla0"));
+  expect_throws("freq table of a device without one", [] {
+    get_devfreq_freq_table("15880000.nvdla0");
+  });
+  expect_throws("reading a missing devfreq device",
+                [] { get_devfreq_min_freq("missing"); });
+}
+
+void test_unknown_soc() {
+  try {
+    get_gpu_cur_freq();
+    std::printf("FAIL an unknown SOC was accepted\n");
+    ++failures();
+  } catch (JetsonClocksException &e) {
+    expect_eq("error names the compatible string", 1,
+              std::strstr(e.what(), "nvidia,tegra234") != nullptr);
+  }
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  bool discover = argc > 1 && std::strcmp(argv[1], "discover") == 0;
+  bool unknown_soc = argc > 1 && std::strcmp(argv[1], "unknown-soc") == 0;
+  if (!discover && !unknown_soc) {
+    std::fprintf(stderr, "usage: %s discover|unknown-soc\n", argv[0]);
+    return 2;
+  }
+
+  FakeTree tree("devfreq");
+  if (discover) {
+    make_tx2(tree.root());
+    return run_checks(test_discover);
+  }
+  tree.put("/proc/device-tree/compatible",
+           std::string("nvidia,p3701-0000\0nvidia,tegra234\0", 35));
+  return run_checks(test_unknown_soc);
+}
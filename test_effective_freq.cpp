@@ -0,0 +1,93 @@
+#include "test_util.hpp"
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace jetson_clocks;
+
+// Checks the effective frequency arithmetic, including a cpu that idled for
+// part of the interval, the idle times parsed from /proc/stat, that snapshots
+// leave both unset until an EffectiveFreqMonitor fills them in, and, where
+// this machine has cpu cycle counters, that a cpu busy for half the
+// interval reads a plausible frequency.
+namespace {
+
+void spin_ms(int ms) {
+  auto stop = std::chrono::steady_clock::now() + std::chrono::milliseconds(ms);
+  while (std::chrono::steady_clock::now() < stop) {
+  }
+}
+
+void test_effective_freq(const FakeTree &tree) {
+  // 1.9072 GHz for the whole of 10 ms.
+  expect_eq("busy", 1907200,
+            effective_freq_khz(19072000, 10000000, 10000000, 10000000));
+  // Multiplexed: counted for 2.5 ms of the interval.
+  expect_eq("multiplexed", 1907200,
+            effective_freq_khz(4768000, 10000000, 2500000, 10000000));
+  // 1.9072 GHz for 2.5 ms, idle for the rest.
+  expect_eq("partly idle", 1907200,
+            effective_freq_khz(4768000, 10000000, 10000000, 2500000));
+  // Busy for 5 ms, and counted for 5 ms of the interval.
+  expect_eq("partly idle and multiplexed", 1907200,
+            effective_freq_khz(4768000, 10000000, 5000000, 5000000));
+  expect_eq("not run", -1, effective_freq_khz(0, 10000000, 0, 10000000));
+  expect_eq("idle", -1, effective_freq_khz(0, 10000000, 10000000, 0));
+
+  // 10 ms ticks, and the buffer ended in the middle of cpu3's line.
+  const char *stat = "cpu  400 0 300 9000 30 0 10 0 0 0\n"
+                     "cpu0 100 0 100 4000 10 0 5 0 0 0\n"
+                     "cpu2 300 0 200 5000 20 0 5 0 0 0\n"
+                     "cpu3 300 0 200 50";
+  std::vector<long long int> idle_ns(4);
+  parse_cpu_idle_ns(stat, {0, 1, 2, 3}, 10000000, idle_ns);
+  expect_eq("cpu0 idle", 40100000000, idle_ns[0]);
+  expect_eq("cpu1 not listed", -1, idle_ns[1]);
+  expect_eq("cpu2 idle", 50200000000, idle_ns[2]);
+  expect_eq("cpu3 cut off", -1, idle_ns[3]);
+
+  Snapshot snap = snapshot();
+  for (int slot = 0; slot < snap.num_cpus; ++slot) {
+    expect_eq("unset effective freq", -1, snap.cpus[slot].effective_freq);
+    expect_eq("unset busy time", -1, snap.cpus[slot].busy_us);
+  }
+
+  // Counters and idle times for the cpu this test runs on, not the fake
+  // tree's. The test pins itself there, spins for 200 ms and sleeps for
+  // 200 ms, which the cycles alone would report as half the clock.
+  set_root_dir("");
+  int cpu_id = sched_getcpu();
+  cpu_set_t cpus;
+  CPU_ZERO(&cpus);
+  CPU_SET(cpu_id, &cpus);
+  sched_setaffinity(0, sizeof(cpus), &cpus);
+  try {
+    EffectiveFreqMonitor monitor(std::vector<int>{cpu_id});
+    spin_ms(200);
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    long int freq = monitor.sample()[0];
+    long int busy_us = monitor.busy_us()[0];
+    std::printf("cpu%d: %ld kHz, busy %ld us of 400000\n", cpu_id, freq,
+                busy_us);
+    if (freq <= 0 || freq > 10000000) {
+      std::printf("FAIL effective freq of a half busy cpu: %ld kHz\n", freq);
+      ++failures();
+    }
+    if (busy_us < 150000 || busy_us > 300000) {
+      std::printf("FAIL busy time of a half busy cpu: %ld us\n", busy_us);
+      ++failures();
+    }
+  } catch (JetsonClocksException &e) {
+    std::printf("no cycle counters, skipping measurement: %s\n", e.what());
+  }
+  set_root_dir(tree.root());
+}
+
+} // namespace
+
+int main() {
+  FakeTree tree("effective_freq");
+  return run_checks([&] { test_effective_freq(tree); });
+}
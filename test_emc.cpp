@@ -0,0 +1,46 @@
+#include "test_util.hpp"
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <vector>
+
+using namespace jetson_clocks;
+
+// Checks that the EMC freq table is the DVFS table from possible_rates,
+// limited to [min_rate, max_rate] and the nvpmodel cap, and that set_emc_freq
+// and apply_profile round up to the next operating point.
+namespace {
+
+void test_emc(const FakeTree &tree) {
+  Span<long int> table = get_emc_freq_table();
+  expect_eq("table size", 8, table.size());
+  expect_eq("table min", 204000000, table.front());
+  expect_eq("table max", 1866000000, table.back());
+  expect_eq("available", 8, get_emc_available_freqs().size());
+
+  set_emc_freq(1000000000);
+  expect_eq("rounded up", 1065600000, get_emc_freq());
+  set_emc_freq(665600000);
+  expect_eq("exact", 665600000, get_emc_freq());
+
+  tree.put("/sys/kernel/nvpmodel_emc_cap/emc_iso_cap", "1700000000\n");
+  std::vector<long int> capped = get_emc_available_freqs();
+  expect_eq("capped size", 7, capped.size());
+  expect_eq("capped max", 1600000000, capped.back());
+  expect_throws("setting emc freq above the cap",
+                [&] { set_emc_freq(1700000000); });
+
+  ClockProfile profile;
+  profile.emc_freq = 300000000;
+  apply_profile(profile);
+  expect_eq("profile rounded up", 408000000, get_emc_freq());
+}
+
+} // namespace
+
+int main() {
+  FakeTree tree("emc");
+  // This board's max_rate leaves out the top operating point.
+  tree.put("/sys/kernel/debug/bpmp/debug/clk/emc/max_rate", "1866000000\n");
+  return run_checks([&] { test_emc(tree); });
+}
@@ -0,0 +1,76 @@
+#include "test_util.hpp"
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <string>
+#include <thread>
+
+using namespace jetson_clocks;
+
+// Checks that measure_energy() integrates the fake tree's constant rail
+// power over exactly the time the callable ran, and reports the iterations
+// and clock settings of the run, and that the reading taken after the last
+// call closes the run.
+namespace {
+
+const char *gpu_power =
+    "/sys/bus/i2c/drivers/ina3221x/1-0040/iio:device0/in_power0_input";
+
+void test_energy(const FakeTree &tree) {
+  int calls = 0;
+  EnergyReport report = measure_energy(
+      [&] {
+        ++calls;
+        std::this_thread::sleep_for(std::chrono::milliseconds(2));
+      },
+      10);
+
+  expect_eq("calls", 10, calls);
+  expect_eq("iterations", 10, report.iterations);
+  expect_eq("rails", 6, report.rails.size());
+  expect_eq("sampled during the run", 1, report.samples > 0);
+  expect_eq("dropped", 0, report.dropped);
+  expect_eq("clock policies", kNumCpus / 2, report.clocks.policies.size());
+  expect_near("time per iteration", report.wall_time_s / 10,
+              report.time_per_iteration_s);
+  if (report.rails.size() != 6) {
+    return;
+  }
+
+  // GPU draws 500 mW and SYS5V 3000 mW for the whole run.
+  const RailEnergy &gpu = report.rails[0];
+  expect_eq("first rail is GPU", 1, gpu.rail.name == "GPU");
+  expect_near("gpu average power", 500, gpu.average_power_mw);
+  expect_near("gpu energy", 0.5 * report.wall_time_s, gpu.energy_j);
+  expect_near("gpu energy per iteration", gpu.energy_j / 10,
+              gpu.energy_per_iteration_j);
+  expect_near("SYS5V average power", 3000, report.rails[5].average_power_mw);
+
+  // With no sampler tick during the run, the GPU power ramps from the
+  // reading before the first call to the one after the last.
+  EnergyOptions slow;
+  slow.period_us = 10000000;
+  calls = 0;
+  report = measure_energy(
+      [&] {
+        std::this_thread::sleep_for(std::chrono::milliseconds(2));
+        if (++calls == 10) {
+          tree.put(gpu_power, "1500\n");
+        }
+      },
+      10, slow);
+  expect_eq("samples with a slow sampler", 0, report.samples);
+  expect_near("gpu power ramped to the last reading", 1000,
+              report.rails[0].average_power_mw);
+  expect_near("SYS5V power unchanged", 3000, report.rails[5].average_power_mw);
+
+  expect_throws("measuring zero iterations",
+                [&] { measure_energy([] {}, 0); });
+}
+
+} // namespace
+
+int main() {
+  FakeTree tree("energy");
+  return run_checks([&] { test_energy(tree); });
+}
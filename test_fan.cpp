@@ -0,0 +1,85 @@
+#include "test_util.hpp"
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+using namespace jetson_clocks;
+
+// Checks that a FanController follows its curve with hysteresis, limits
+// how fast the pwm changes, writes only when it changes, and that its PID
+// mode responds in proportion to the error. The fake tree's hottest zone is
+// CPU-therm at 45.5 °C, and the fan starts at 77.
+//
+//   jetson_clocks_test_fan curve|pid
+namespace {
+
+const FakeTree *fake_tree = nullptr;
+
+void set_temp(int zone, long int temp_mc) {
+  std::string dir = "/sys/class/thermal/thermal_zone" + std::to_string(zone);
+  fake_tree->put(dir + "/temp", std::to_string(temp_mc) + "\n");
+}
+
+void test_curve() {
+  FanControllerOptions options;
+  options.max_step = 255;
+  FanController fan(options);
+
+  // Between 40 and 50 °C the default curve goes from 0 to 80.
+  expect_eq("pwm at 45.5", 44, fan.tick());
+  expect_eq("fan at 45.5", 44, get_fan_speed());
+  expect_eq("writes", 1, fan.writes());
+  expect_eq("pwm again", 44, fan.tick());
+  expect_eq("writes unchanged", 1, fan.writes());
+
+  // A fall within the hysteresis band keeps the speed.
+  set_temp(1, 30000);
+  set_temp(0, 44500);
+  expect_eq("pwm after a small fall", 44, fan.tick());
+  expect_eq("writes after a small fall", 1, fan.writes());
+  // A larger fall slows the fan to the curve 2 °C above the temperature.
+  set_temp(0, 42000);
+  expect_eq("pwm after a large fall", 32, fan.tick());
+  set_temp(0, 38000);
+  expect_eq("pwm below the curve", 0, fan.tick());
+
+  // Following only the GPU zone, with the pwm limited to steps of 10.
+  options.zones = {"GPU"};
+  options.max_step = 10;
+  set_temp(1, 70000);
+  FanController gpu_fan(options);
+  expect_eq("first step", 10, gpu_fan.tick());
+  expect_eq("second step", 20, gpu_fan.tick());
+  expect_eq("fan after steps", 20, get_fan_speed());
+}
+
+void test_pid() {
+  FanControllerOptions options;
+  options.mode = FanMode::pid;
+  options.target_mc = 40000;
+  options.kp = 10;
+  options.ki = 0;
+  options.max_step = 255;
+  FanController fan(options);
+  expect_eq("pwm 5.5 °C above target", 55, fan.tick());
+  set_temp(0, 30000);
+  set_temp(1, 30000);
+  expect_eq("pwm below target", 0, fan.tick());
+  set_temp(0, 80000);
+  expect_eq("pwm far above target", 255, fan.tick());
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  bool curve = argc > 1 && std::strcmp(argv[1], "curve") == 0;
+  bool pid = argc > 1 && std::strcmp(argv[1], "pid") == 0;
+  if (!curve && !pid) {
+    std::fprintf(stderr, "usage: %s curve|pid\n", argv[0]);
+    return 2;
+  }
+
+  FakeTree tree("fan");
+  fake_tree = &tree;
+  return run_checks(curve ? test_curve : test_pid);
+}
@@ -0,0 +1,55 @@
+#include "test_util.hpp"
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+using namespace jetson_clocks;
+
+// Checks that the INA3221 rails of both the iio and the hwmon driver are
+// found, named by domain, measured, and included in snapshots.
+namespace {
+
+void test_power() {
+  std::vector<PowerRail> rails = get_power_rails();
+  expect_eq("rails", 7, rails.size());
+  if (rails.size() != 7) {
+    return;
+  }
+  expect_eq("first rail is GPU", 1, rails[0].name == "GPU");
+  expect_eq("GPU domain", 1, rails[0].domain == "VDD_GPU");
+  expect_eq("VDDRQ domain", 1, rails[4].domain == "VDD_DDR");
+  expect_eq("hwmon rail", 1, rails[6].name == "VDD_EXTRA");
+  expect_eq("unknown domain", 1, rails[6].domain.empty());
+
+  PowerReading gpu = get_power_reading("VDD_GPU");
+  expect_eq("gpu voltage", 5000, gpu.voltage_mv);
+  expect_eq("gpu current", 100, gpu.current_ma);
+  expect_eq("gpu power", 500, gpu.power_mw);
+  expect_eq("cpu power by name", 1000, get_power_mw("CPU"));
+  // The hwmon driver has no power attribute.
+  expect_eq("hwmon power", 6000, get_power_mw("VDD_EXTRA"));
+
+  expect_throws("measuring a missing rail",
+                [&] { get_power_mw("VDD_NOTHING"); });
+
+  Snapshot snap = snapshot();
+  expect_eq("snapshot rails", 7, snap.num_rails);
+  expect_eq("snapshot rail name", 0, std::strcmp(snap.rails[5].name, "SYS5V"));
+  expect_eq("snapshot SYS5V power", 3000, snap.rails[5].power_mw);
+  expect_eq("snapshot hwmon power", 6000, snap.rails[6].power_mw);
+}
+
+} // namespace
+
+int main() {
+  FakeTree tree("power");
+  std::string hwmon = "/sys/bus/i2c/drivers/ina3221/1-0042/hwmon/hwmon3/";
+  tree.put(hwmon + "in1_label", "VDD_EXTRA\n");
+  tree.put(hwmon + "in1_input", "5000\n");
+  tree.put(hwmon + "curr1_input", "1200\n");
+  tree.put(hwmon + "in2_label", "NC\n");
+  tree.put(hwmon + "in2_input", "0\n");
+  tree.put(hwmon + "curr2_input", "0\n");
+  return run_checks(test_power);
+}
@@ -0,0 +1,167 @@
+#include "test_util.hpp"
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+using namespace jetson_clocks;
+
+// Checks that apply_profile() writes only what differs, orders min/max
+// writes so a range is never inverted, and rolls back in reverse when a
+// write fails, and that a ScopedBoost puts back only what it changed, the
+// EMC rate before its override. The platform is detected once per process,
+// so each case runs in its own process:
+//
+//   jetson_clocks_test_profile diff|order|rollback|boost
+namespace {
+
+bool ends_with(const std::string &str, const std::string &suffix) {
+  return str.size() >= suffix.size() &&
+         str.compare(str.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+void expect_write(const char *what, const ApplyReport &report, std::size_t i,
+                  const std::string &suffix) {
+  if (i >= report.writes.size() || !ends_with(report.writes[i].path, suffix)) {
+    std::printf("FAIL %s: write %zu is not %s\n", what, i, suffix.c_str());
+    ++failures();
+  }
+}
+
+ClockProfile cluster_range(long int min_freq, long int max_freq) {
+  ClockProfile profile;
+  PolicyProfile policy;
+  policy.policy_id = 0;
+  policy.min_freq = min_freq;
+  policy.max_freq = max_freq;
+  profile.policies.push_back(policy);
+  return profile;
+}
+
+ClockProfile gpu_range(long int min_freq, long int max_freq) {
+  ClockProfile profile;
+  profile.gpu_min_freq = min_freq;
+  profile.gpu_max_freq = max_freq;
+  return profile;
+}
+
+void expect_rejected(const char *what, const ClockProfile &profile) {
+  expect_throws(what, [&] { apply_profile(profile); });
+}
+
+// Applying the board's own settings writes nothing; changing one setting
+// writes just that attribute.
+void test_diff() {
+  ApplyReport report = apply_profile(read_profile());
+  expect_eq("writes for the current profile", 0, report.writes.size());
+  expect_eq("current profile ok", 1, report.ok());
+
+  ClockProfile profile = cluster_range(1420800, 2265600);
+  profile.fan_speed = 77;
+  report = apply_profile(profile);
+  expect_eq("writes for one change", 1, report.writes.size());
+  expect_write("one change", report, 0, "scaling_min_freq");
+  expect_eq("unchanged for one change", 2, report.unchanged);
+  expect_eq("min after one change", 1420800, get_cluster_min_freq(0));
+}
+
+// Lowering the range writes min first, raising it writes max first, and a
+// single end may not cross the other.
+void test_order() {
+  ApplyReport report = apply_profile(cluster_range(115200, 345600));
+  expect_eq("writes lowering", 2, report.writes.size());
+  expect_write("lowering", report, 0, "scaling_min_freq");
+  expect_write("lowering", report, 1, "scaling_max_freq");
+
+  report = apply_profile(cluster_range(2188800, 2265600));
+  expect_eq("writes raising", 2, report.writes.size());
+  expect_write("raising", report, 0, "scaling_max_freq");
+  expect_write("raising", report, 1, "scaling_min_freq");
+
+  apply_profile(gpu_range(114750000, 216750000));
+  expect_rejected("gpu min above the current max", gpu_range(1377000000, 0));
+  apply_profile(cluster_range(1190400, 1190400));
+  expect_rejected("cpu max below the current min", cluster_range(0, 115200));
+  expect_rejected("cpu min above the current max", cluster_range(2265600, 0));
+  expect_eq("max after rejected profiles", 1190400, get_cluster_max_freq(0));
+}
+
+// The fan is written last; when it fails, the cpu and gpu writes before it
+// are undone.
+void test_rollback() {
+  ClockProfile profile = cluster_range(1420800, 2265600);
+  profile.gpu_max_freq = 1338750000;
+  profile.fan_speed = 255;
+  ApplyReport report = apply_profile(profile);
+  expect_eq("rollback ok", 0, report.ok());
+  expect_eq("rolled back", 1, report.rolled_back);
+  expect_eq("writes before the failure", 3, report.writes.size());
+  expect_write("rollback", report, 2, "target_pwm");
+  expect_eq("min after rollback", 1190400, get_cluster_min_freq(0));
+  expect_eq("gpu max after rollback", 1377000000, get_gpu_max_freq());
+}
+
+// A limit set while the boost is held survives its release, and the rest
+// of what the boost raised goes back.
+void test_boost() {
+  {
+    ScopedBoost boost(BoostDomain::cpu);
+    expect_eq("policy0 min during boost", 2265600, get_cluster_min_freq(0));
+    {
+      ScopedBoost nested(BoostDomain::cpu);
+    }
+    expect_eq("policy0 min after nested boost", 2265600,
+              get_cluster_min_freq(0));
+    set_cluster_min_freq(0, 1420800);
+  }
+  expect_eq("policy0 min set during boost", 1420800, get_cluster_min_freq(0));
+  expect_eq("policy2 min after boost", 1190400, get_cluster_min_freq(2));
+  expect_eq("policy2 max after boost", 2265600, get_cluster_max_freq(2));
+
+  // The EMC rate goes back while the override still holds it.
+  set_emc_freq(665600000);
+  ClockProfile governed;
+  governed.emc_override = 0;
+  apply_profile(governed);
+  ClockProfile boosted;
+  boosted.emc_freq = 2133000000;
+  int unchanged = 0;
+  std::vector<PlannedWrite> plan = plan_profile(boosted, unchanged);
+  std::vector<std::size_t> order = undo_order(plan, plan.size());
+  expect_eq("emc writes in a boost", 2, static_cast<long int>(plan.size()));
+  expect_eq("emc rate undone first", 1,
+            plan[order[0]].attr == get_platform().emc_rate);
+  {
+    ScopedBoost boost(BoostDomain::emc);
+    expect_eq("emc freq during boost", 2133000000, get_emc_freq());
+  }
+  expect_eq("emc freq after boost", 665600000, get_emc_freq());
+  expect_eq("emc override after boost", 0, read_profile().emc_override);
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  const char *name = argc > 1 ? argv[1] : "";
+  void (*test)() = nullptr;
+  if (std::strcmp(name, "diff") == 0) {
+    test = test_diff;
+  } else if (std::strcmp(name, "order") == 0) {
+    test = test_order;
+  } else if (std::strcmp(name, "rollback") == 0) {
+    test = test_rollback;
+  } else if (std::strcmp(name, "boost") == 0) {
+    test = test_boost;
+  } else {
+    std::fprintf(stderr, "usage: %s diff|order|rollback|boost\n", argv[0]);
+    return 2;
+  }
+
+  FakeTree tree("profile");
+  if (test == test_rollback) {
+    // Every write to /dev/full fails with ENOSPC.
+    std::string fan = tree.root() + "/sys/kernel/debug/tegra_fan/target_pwm";
+    std::remove(fan.c_str());
+    symlink("/dev/full", fan.c_str());
+  }
+  return run_checks(test);
+}
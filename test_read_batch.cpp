@@ -0,0 +1,115 @@
+#include "test_util.hpp"
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <string>
+#include <sys/resource.h>
+#include <unistd.h>
+#include <vector>
+
+using namespace jetson_clocks;
+
+// Checks that a ReadBatch reads what Attribute::read() reads, attribute by
+// attribute, including a missing one, a truncated one and values that
+// change between batches, with the io_uring backend and without. Built
+// once with JETSON_CLOCKS_USE_IO_URING and once without; it also checks
+// that a batch falls back to pread() when io_uring cannot be set up, here
+// because no descriptor is left for the ring.
+namespace {
+
+const char *paths[] = {
+    "/sys/devices/system/cpu/cpu0/cpufreq/scaling_cur_freq",
+    "/sys/kernel/debug/bpmp/debug/clk/emc/rate",
+    "/sys/does/not/exist",
+    "/proc/device-tree/model",
+};
+
+std::vector<Attribute *> attributes() {
+  std::vector<Attribute *> attrs;
+  for (const char *path : paths) {
+    attrs.push_back(&attribute(path));
+  }
+  return attrs;
+}
+
+// Every result and buffer of the batch matches a read of its attribute.
+void expect_batch(const char *what, ReadBatch &batch,
+                  const std::vector<Attribute *> &attrs,
+                  std::size_t buf_size) {
+  batch.read_all();
+  for (std::size_t i = 0; i < attrs.size(); ++i) {
+    std::vector<char> buf(buf_size);
+    long int n = attrs[i]->read(buf.data(), buf_size - 1);
+    if (batch.result(i) != n ||
+        (n > 0 && std::memcmp(batch.data(i), buf.data(), n) != 0)) {
+      std::printf("FAIL %s: %s read %ld bytes in the batch, %ld alone\n", what,
+                  attrs[i]->path().c_str(), batch.result(i), n);
+      ++failures();
+    }
+  }
+}
+
+void test_read_batch(const FakeTree &tree) {
+  std::vector<Attribute *> attrs = attributes();
+  for (ReadBackend backend : {ReadBackend::pread, ReadBackend::io_uring}) {
+    ReadBatch batch(attrs, backend);
+#ifndef JETSON_CLOCKS_USE_IO_URING
+    expect_eq("backend without io_uring", 1,
+              batch.backend() == ReadBackend::pread);
+#endif
+    std::printf("%s batch reads with %s\n",
+                backend == ReadBackend::pread ? "pread" : "io_uring",
+                batch.backend() == ReadBackend::pread ? "pread" : "io_uring");
+    expect_eq("batch size", 4, batch.size());
+    expect_batch("first batch", batch, attrs, 64);
+    expect_eq("missing attribute", -1, batch.result(2));
+    expect_eq("cpu0 cur freq", 1907200,
+              parse_long(batch.data(0), batch.result(0)));
+
+    tree.put(paths[0], "1420800\n");
+    tree.put(paths[1], "665600000\n");
+    expect_batch("changed batch", batch, attrs, 64);
+    expect_eq("changed cpu0 cur freq", 1420800,
+              parse_long(batch.data(0), batch.result(0)));
+    expect_eq("changed emc rate", 665600000,
+              parse_long(batch.data(1), batch.result(1)));
+    tree.put(paths[0], "1907200\n");
+    tree.put(paths[1], "2133000000\n");
+
+    // Each read stops one byte short of the buffer.
+    ReadBatch small(attrs, backend, 4);
+    expect_batch("truncated batch", small, attrs, 4);
+    expect_eq("truncated emc rate", 3, small.result(1));
+  }
+}
+
+void test_fallback() {
+  // Open every descriptor the batch needs, then allow no more.
+  std::vector<Attribute *> attrs = attributes();
+  for (Attribute *attr : attrs) {
+    attr->fd();
+  }
+  int lowest_free = open("/dev/null", O_RDONLY);
+  close(lowest_free);
+  struct rlimit before;
+  getrlimit(RLIMIT_NOFILE, &before);
+  struct rlimit limit = before;
+  limit.rlim_cur = lowest_free;
+  setrlimit(RLIMIT_NOFILE, &limit);
+
+  ReadBatch batch(attrs, ReadBackend::io_uring);
+  expect_eq("fallback backend", 1, batch.backend() == ReadBackend::pread);
+  expect_batch("fallback batch", batch, attrs, 64);
+
+  setrlimit(RLIMIT_NOFILE, &before);
+}
+
+} // namespace
+
+int main() {
+  FakeTree tree("read_batch");
+  return run_checks([&] {
+    test_read_batch(tree);
+    test_fallback();
+  });
+}
@@ -0,0 +1,158 @@
+#include "test_util.hpp"
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace jetson_clocks;
+
+// Checks that an SpscRing is FIFO through full, empty and wraparound, also
+// across threads, and that a Sampler on the fake tree ticks, reads its
+// attributes, counts the samples a stalled consumer loses, and keeps its
+// jitter and overrun counters consistent with the samples it took.
+namespace {
+
+const char *cpu0_cur_freq =
+    "/sys/devices/system/cpu/cpu0/cpufreq/scaling_cur_freq";
+const char *emc_rate = "/sys/kernel/debug/bpmp/debug/clk/emc/rate";
+
+void test_ring() {
+  SpscRing<int> ring(5);
+  expect_eq("capacity rounded up", 8, ring.capacity());
+  int item = -1;
+  expect_eq("pop from empty", 0, ring.pop(item));
+  for (int i = 0; i < 8; ++i) {
+    expect_eq("push below capacity", 1, ring.push(i));
+  }
+  expect_eq("push when full", 0, ring.push(8));
+  expect_eq("size when full", 8, ring.size());
+  for (int i = 0; i < 8; ++i) {
+    ring.pop(item);
+    expect_eq("pop order", i, item);
+  }
+  expect_eq("pop when drained", 0, ring.pop(item));
+
+  // Three laps around the slots, never more than five items apart.
+  int pushed = 0;
+  int popped = 0;
+  while (popped < 24) {
+    while (pushed - popped < 5) {
+      ring.push(pushed++);
+    }
+    ring.pop(item);
+    expect_eq("pop order across laps", popped++, item);
+  }
+
+  // One producer thread and this thread as the consumer.
+  const int count = 100000;
+  SpscRing<int> shared(64);
+  std::thread producer([&] {
+    for (int i = 0; i < count; ++i) {
+      while (!shared.push(i)) {
+        std::this_thread::yield();
+      }
+    }
+  });
+  int expected = 0;
+  while (expected < count) {
+    if (!shared.pop(item)) {
+      std::this_thread::yield();
+      continue;
+    }
+    if (item != expected) {
+      std::printf("FAIL pop order across threads: expected %d, got %d\n",
+                  expected, item);
+      ++failures();
+      break;
+    }
+    ++expected;
+  }
+  producer.join();
+}
+
+void test_sampler() {
+  SamplerOptions options;
+  options.paths = {cpu0_cur_freq, emc_rate, "/sys/does/not/exist"};
+  options.period_us = 1000;
+  options.capacity = 4;
+
+  // Nobody pops while it runs, so all but the first four samples drop.
+  Sampler stalled(options);
+  stalled.start();
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  stalled.stop();
+  SamplerStats stats = stalled.stats();
+  expect_eq("ticks while stalled", 1, stats.ticks >= 10);
+  expect_eq("dropped while stalled", stats.ticks - 4, stats.dropped);
+  Sample sample;
+  unsigned long long int last_tick = 0;
+  int kept = 0;
+  while (stalled.pop(sample)) {
+    expect_eq("ticks increase", 1, sample.tick > last_tick);
+    last_tick = sample.tick;
+    ++kept;
+  }
+  expect_eq("samples kept", 4, kept);
+  expect_eq("first samples kept", 1, last_tick <= 4 + stats.overruns);
+
+  // Drained as it runs, every tick is kept in order.
+  options.capacity = 1024;
+  Sampler sampler(options);
+  sampler.start();
+  std::vector<Sample> samples;
+  for (int i = 0; i < 50; ++i) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    while (sampler.pop(sample)) {
+      samples.push_back(sample);
+    }
+  }
+  sampler.stop();
+  while (sampler.pop(sample)) {
+    samples.push_back(sample);
+  }
+  stats = sampler.stats();
+  expect_eq("samples taken", stats.ticks, samples.size());
+  expect_eq("nothing dropped", 0, stats.dropped);
+  if (samples.empty()) {
+    return;
+  }
+  long long int max_jitter = 0;
+  long long int total_jitter = 0;
+  for (std::size_t i = 0; i < samples.size(); ++i) {
+    const Sample &s = samples[i];
+    if (i > 0) {
+      expect_eq("ticks increase", 1, s.tick > samples[i - 1].tick);
+      expect_eq("time increases", 1, s.time_ns > samples[i - 1].time_ns);
+    }
+    expect_eq("values", 3, s.num_values);
+    expect_eq("cpu0 cur freq", 1907200, s.values[0]);
+    expect_eq("emc rate", 2133000000, s.values[1]);
+    expect_eq("missing attribute", -1, s.values[2]);
+    expect_eq("jitter is lateness", 1, s.jitter_ns >= 0);
+    max_jitter = std::max(max_jitter, s.jitter_ns);
+    total_jitter += s.jitter_ns;
+  }
+  // A tick counts every expiration, so the ticks skipped are the overruns.
+  expect_eq("last tick", stats.ticks + stats.overruns, samples.back().tick);
+  expect_eq("max jitter", max_jitter, stats.max_jitter_ns);
+  expect_eq("mean jitter", total_jitter / samples.size(),
+            stats.mean_jitter_ns);
+
+  options.period_us = 0;
+  expect_throws("sampling with no period", [&] { Sampler bad(options); });
+  options.period_us = 1000;
+  options.cpu = 1023;
+  Sampler unpinnable(options);
+  expect_throws("pinning to a missing cpu", [&] { unpinnable.start(); });
+}
+
+} // namespace
+
+int main() {
+  FakeTree tree("sampler");
+  return run_checks([] {
+    test_ring();
+    test_sampler();
+  });
+}
@@ -0,0 +1,76 @@
+#include "test_util.hpp"
+#include <cstdio>
+#include <vector>
+
+using namespace jetson_clocks;
+
+// Checks snap_freq() with every rounding mode, on exact entries, between
+// entries and beyond both ends of the table.
+namespace {
+
+const char *rounding_name(Rounding rounding) {
+  switch (rounding) {
+  case Rounding::floor:
+    return "floor";
+  case Rounding::ceil:
+    return "ceil";
+  default:
+    return "nearest";
+  }
+}
+
+void expect_snap(Span<long int> table, long int target, Rounding rounding,
+                 long int expected) {
+  long int actual = snap_freq(table, target, rounding);
+  if (actual != expected) {
+    std::printf("FAIL snap_freq(%ld, %s): expected %ld, got %ld\n", target,
+                rounding_name(rounding), expected, actual);
+    ++failures();
+  }
+}
+
+} // namespace
+
+int main() {
+  const std::vector<long int> freqs = {115200, 192000, 268800, 2265600};
+  Span<long int> table(freqs);
+
+  for (Rounding rounding :
+       {Rounding::floor, Rounding::ceil, Rounding::nearest}) {
+    // Exact entries, including both ends, are kept.
+    expect_snap(table, 115200, rounding, 115200);
+    expect_snap(table, 192000, rounding, 192000);
+    expect_snap(table, 2265600, rounding, 2265600);
+    // Beyond the ends, every mode clamps to the table.
+    expect_snap(table, 0, rounding, 115200);
+    expect_snap(table, -1, rounding, 115200);
+    expect_snap(table, 3000000, rounding, 2265600);
+  }
+
+  expect_snap(table, 200000, Rounding::floor, 192000);
+  expect_snap(table, 200000, Rounding::ceil, 268800);
+  expect_snap(table, 200000, Rounding::nearest, 192000);
+  expect_snap(table, 260000, Rounding::nearest, 268800);
+  // A tie goes to the lower entry.
+  expect_snap(table, 230400, Rounding::nearest, 192000);
+  // Just inside the ends.
+  expect_snap(table, 115201, Rounding::floor, 115200);
+  expect_snap(table, 115201, Rounding::ceil, 192000);
+  expect_snap(table, 2265599, Rounding::floor, 268800);
+  expect_snap(table, 2265599, Rounding::ceil, 2265600);
+  expect_snap(table, 2265599, Rounding::nearest, 2265600);
+
+  // A single entry table snaps everything to it.
+  const std::vector<long int> one = {1377000000};
+  for (Rounding rounding :
+       {Rounding::floor, Rounding::ceil, Rounding::nearest}) {
+    expect_snap(Span<long int>(one), 0, rounding, 1377000000);
+    expect_snap(Span<long int>(one), 2000000000, rounding, 1377000000);
+  }
+
+  expect_throws("snap_freq() on an empty table", [] {
+    snap_freq(Span<long int>(), 1, Rounding::nearest);
+  });
+
+  return failures() == 0 ? 0 : 1;
+}
@@ -0,0 +1,129 @@
+#include "test_util.hpp"
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+using namespace jetson_clocks;
+
+// Checks that snapshot() reports what the individual getters read, with
+// every cluster set apart so a value stored in the wrong cpu's slot shows,
+// and that attributes missing from the tree read as -1 without throwing.
+namespace {
+
+const char *policy_dir = "/sys/devices/system/cpu/cpufreq/policy";
+const char *gpu_dir = "/sys/devices/17000000.gv11b/devfreq/17000000.gv11b/";
+const char *emc_rate = "/sys/kernel/debug/bpmp/debug/clk/emc/rate";
+const char *fan_pwm = "/sys/kernel/debug/tegra_fan/target_pwm";
+
+std::string policy(int policy_id, const char *name) {
+  return policy_dir + std::to_string(policy_id) + "/" + name;
+}
+
+void expect_cpus(const Snapshot &snap) {
+  expect_eq("cpus", 8, snap.num_cpus);
+  for (int slot = 0; slot < snap.num_cpus; ++slot) {
+    const CpuSnapshot &cpu = snap.cpus[slot];
+    expect_eq("cpu id", slot, cpu.cpu_id);
+    expect_eq("cpu cur freq", get_cpu_cur_freq(cpu.cpu_id), cpu.cur_freq);
+    expect_eq("cpu min freq", get_cpu_min_freq(cpu.cpu_id), cpu.min_freq);
+    expect_eq("cpu max freq", get_cpu_max_freq(cpu.cpu_id), cpu.max_freq);
+    if (get_cpu_governor(cpu.cpu_id) != cpu.governor) {
+      std::printf("FAIL cpu%d governor: expected %s, got %s\n", cpu.cpu_id,
+                  get_cpu_governor(cpu.cpu_id).c_str(), cpu.governor);
+      ++failures();
+    }
+  }
+}
+
+void test_getters(const FakeTree &tree) {
+  const char *governors[] = {"schedutil", "performance", "powersave",
+                             "userspace"};
+  for (int policy_id = 0; policy_id < 8; policy_id += 2) {
+    long int step = 76800 * policy_id;
+    tree.put(policy(policy_id, "scaling_cur_freq"),
+             std::to_string(1420800 + step) + "\n");
+    tree.put(policy(policy_id, "scaling_min_freq"),
+             std::to_string(115200 + step) + "\n");
+    tree.put(policy(policy_id, "scaling_max_freq"),
+             std::to_string(2265600 - step) + "\n");
+    tree.put(policy(policy_id, "scaling_governor"),
+             std::string(governors[policy_id / 2]) + "\n");
+  }
+  tree.put(std::string(gpu_dir) + "cur_freq", "522750000\n");
+  tree.put(std::string(gpu_dir) + "min_freq", "318750000\n");
+  tree.put(std::string(gpu_dir) + "max_freq", "1236750000\n");
+  tree.put(std::string(gpu_dir) + "device/load", "473\n");
+  tree.put(emc_rate, "1600000000\n");
+  tree.put(fan_pwm, "128\n");
+
+  for (ReadBackend backend : {ReadBackend::pread, ReadBackend::io_uring}) {
+    set_snapshot_backend(backend);
+    Snapshot snap = snapshot();
+    expect_eq("snapshot times", 1, snap.start_ns <= snap.end_ns);
+    expect_cpus(snap);
+    expect_eq("cpu2 cur freq", 1574400, snap.cpus[2].cur_freq);
+    expect_eq("gpu cur freq", get_gpu_cur_freq(), snap.gpu_cur_freq);
+    expect_eq("gpu min freq", get_gpu_min_freq(), snap.gpu_min_freq);
+    expect_eq("gpu max freq", get_gpu_max_freq(), snap.gpu_max_freq);
+    expect_eq("gpu load", get_gpu_current_usage(), snap.gpu_load);
+    expect_eq("emc freq", get_emc_freq(), snap.emc_freq);
+    expect_eq("fan pwm", get_fan_speed(), snap.fan_pwm);
+    expect_eq("gpu temp", get_zone_temp("GPU-therm"), snap.zones[1].temp_mc);
+  }
+}
+
+void test_missing(const FakeTree &tree) {
+  // Removed before the platform is detected, as on a board without them.
+  std::remove((tree.root() + policy(2, "scaling_cur_freq")).c_str());
+  std::remove((tree.root() + policy(4, "scaling_max_freq")).c_str());
+  std::remove((tree.root() + gpu_dir + "device/load").c_str());
+  std::remove((tree.root() + emc_rate).c_str());
+  std::remove((tree.root() + fan_pwm).c_str());
+
+  for (ReadBackend backend : {ReadBackend::pread, ReadBackend::io_uring}) {
+    set_snapshot_backend(backend);
+    Snapshot snap;
+    try {
+      snapshot(snap);
+    } catch (JetsonClocksException &e) {
+      std::printf("FAIL snapshot with missing attributes threw: %s\n",
+                  e.what());
+      ++failures();
+      return;
+    }
+    for (int slot : {2, 3}) {
+      expect_eq("missing cpu cur freq", -1, snap.cpus[slot].cur_freq);
+      expect_eq("cpu min freq", get_cpu_min_freq(slot),
+                snap.cpus[slot].min_freq);
+    }
+    for (int slot : {4, 5}) {
+      expect_eq("missing cpu max freq", -1, snap.cpus[slot].max_freq);
+      expect_eq("cpu cur freq", get_cpu_cur_freq(slot),
+                snap.cpus[slot].cur_freq);
+    }
+    expect_eq("cpu0 cur freq", get_cpu_cur_freq(0), snap.cpus[0].cur_freq);
+    expect_eq("missing gpu load", -1, snap.gpu_load);
+    expect_eq("gpu cur freq", get_gpu_cur_freq(), snap.gpu_cur_freq);
+    expect_eq("missing emc freq", -1, snap.emc_freq);
+    expect_eq("missing fan pwm", -1, snap.fan_pwm);
+    expect_eq("cpu temp", get_zone_temp("CPU-therm"), snap.zones[0].temp_mc);
+  }
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  const char *name = argc > 1 ? argv[1] : "";
+  void (*test)(const FakeTree &) = nullptr;
+  if (std::strcmp(name, "getters") == 0) {
+    test = test_getters;
+  } else if (std::strcmp(name, "missing") == 0) {
+    test = test_missing;
+  } else {
+    std::fprintf(stderr, "usage: %s getters|missing\n", argv[0]);
+    return 2;
+  }
+
+  FakeTree tree("snapshot");
+  return run_checks([&] { test(tree); });
+}
@@ -0,0 +1,75 @@
+#include "test_util.hpp"
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+using namespace jetson_clocks;
+
+// Checks that restore_state() puts back what save_state() saved, makes no
+// writes when nothing changed, and rejects state from another SOC family or
+// a damaged blob. The platform is detected once per process, so each case
+// runs in its own process:
+//
+//   jetson_clocks_test_state round-trip|reject
+namespace {
+
+void expect_rejected(const char *what, const std::vector<unsigned char> &state) {
+  expect_throws(what, [&] { restore_state(state); });
+}
+
+void test_round_trip() {
+  std::vector<unsigned char> state = save_state();
+  expect_eq("writes restoring an unchanged board", 0,
+            restore_state(state).writes.size());
+
+  set_cluster_governor(2, "performance");
+  set_cluster_max_freq(2, 1958400);
+  set_gpu_freq_range(420750000, 624750000); // Also turns railgating off.
+  set_fan_speed(200); // The cpu setters also turned qos off.
+
+  ApplyReport report = restore_state(state);
+  expect_eq("restore ok", 1, report.ok());
+  expect_eq("writes restoring", 7, report.writes.size());
+  expect_eq("policy2 governor", 1, get_cluster_governor(2) == "schedutil");
+  expect_eq("policy2 max", 2265600, get_cluster_max_freq(2));
+  expect_eq("gpu min", 114750000, get_gpu_min_freq());
+  expect_eq("gpu max", 1377000000, get_gpu_max_freq());
+  expect_eq("fan", 77, get_fan_speed());
+  expect_eq("qos", 1, std::stol(read_file("/sys/module/qos/parameters/enable")));
+  expect_eq("writes restoring again", 0, restore_state(state).writes.size());
+}
+
+void test_reject() {
+  std::vector<unsigned char> state = save_state();
+
+  // The SOC family follows the magic and the version.
+  std::vector<unsigned char> foreign = state;
+  foreign[6] = static_cast<unsigned char>(SocFamily::tegra186);
+  expect_rejected("another SOC family", foreign);
+
+  std::vector<unsigned char> truncated(state.begin(), state.end() - 1);
+  expect_rejected("a truncated blob", truncated);
+
+  std::vector<unsigned char> version = state;
+  version[4] = 0xff;
+  expect_rejected("an unknown version", version);
+
+  std::vector<unsigned char> magic = state;
+  magic[0] = 'X';
+  expect_rejected("a bad magic", magic);
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  bool round_trip = argc > 1 && std::strcmp(argv[1], "round-trip") == 0;
+  bool reject = argc > 1 && std::strcmp(argv[1], "reject") == 0;
+  if (!round_trip && !reject) {
+    std::fprintf(stderr, "usage: %s round-trip|reject\n", argv[0]);
+    return 2;
+  }
+
+  FakeTree tree("state");
+  return run_checks(round_trip ? test_round_trip : test_reject);
+}
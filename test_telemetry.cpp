@@ -0,0 +1,148 @@
+#include "test_util.hpp"
+#include <cstdio>
+#include <fcntl.h>
+#include <string>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <vector>
+
+using namespace jetson_clocks;
+
+// Checks that a TelemetryReader sees what a TelemetryPublisher publishes:
+// the newest snapshot, the history ring in order, and that publications the
+// ring has already overwritten are skipped rather than returned stale. Also
+// checks that a running publisher's segment cannot be taken over, and that
+// one left behind by a publisher that died is replaced without disturbing a
+// reader still attached to it, and that readers give up on a slot a dead
+// publisher left mid-write instead of spinning on it.
+namespace {
+
+Snapshot numbered(long int n) {
+  Snapshot snap = snapshot();
+  snap.emc_freq = n;
+  return snap;
+}
+
+void test_telemetry(const std::string &name) {
+  TelemetryPublisher publisher(name, 4);
+  TelemetryReader reader(name);
+
+  Snapshot snap;
+  expect_eq("latest before publishing", 0, reader.latest(snap));
+
+  publisher.publish();
+  expect_eq("latest after publishing", 1, reader.latest(snap));
+  expect_eq("published emc freq", 2133000000, snap.emc_freq);
+  expect_eq("published cpus", kNumCpus, snap.num_cpus);
+  expect_eq("published cpu0 freq", 1907200, snap.cpus[0].cur_freq);
+
+  unsigned long long int next = 0;
+  std::vector<Snapshot> history;
+  expect_eq("history after one", 1, reader.read_since(next, history));
+  expect_eq("next after one", 1, next);
+
+  // Six more into a ring of four: publications 1 and 2 are overwritten.
+  for (long int n = 1; n <= 6; ++n) {
+    publisher.publish(numbered(n));
+  }
+  history.clear();
+  expect_eq("history after a lap", 4, reader.read_since(next, history));
+  expect_eq("next after a lap", 7, next);
+  for (std::size_t i = 0; i < history.size(); ++i) {
+    expect_eq("history order", 3 + i, history[i].emc_freq);
+  }
+  expect_eq("latest after a lap", 1, reader.latest(snap));
+  expect_eq("latest emc freq", 6, snap.emc_freq);
+  expect_eq("published", 7, reader.published());
+
+  expect_throws("attaching to a missing segment", [&] {
+    TelemetryReader missing(name + ".missing");
+  });
+  expect_throws("publishing into a live segment",
+                [&] { TelemetryPublisher second(name, 4); });
+}
+
+// Set the sequence of publication n's slot, as a publisher that died while
+// writing it would have left it.
+void set_sequence(const std::string &name, std::size_t capacity,
+                  std::uint64_t n, std::uint64_t sequence) {
+  int fd = shm_open(("/" + name).c_str(), O_RDWR, 0);
+  void *map = mmap(nullptr, telemetry_map_size(capacity),
+                   PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    std::printf("FAIL cannot map %s\n", name.c_str());
+    ++failures();
+    return;
+  }
+  telemetry_slots(map)[n % capacity].sequence.store(sequence);
+  munmap(map, telemetry_map_size(capacity));
+}
+
+void test_torn(const std::string &name) {
+  Snapshot snap;
+  {
+    // The only slot was being overwritten by publication 1.
+    TelemetryPublisher publisher(name, 1);
+    TelemetryReader reader(name);
+    publisher.publish(numbered(1));
+    set_sequence(name, 1, 1, 2 * 1 + 1);
+    expect_eq("latest of a lapped slot", 0, reader.latest(snap));
+  }
+  {
+    // Publication 1 was left mid-write.
+    TelemetryPublisher publisher(name, 4);
+    TelemetryReader reader(name);
+    publisher.publish(numbered(1));
+    publisher.publish(numbered(2));
+    set_sequence(name, 4, 1, 2 * 1 + 1);
+    expect_eq("latest of a torn slot", 0, reader.latest(snap));
+    unsigned long long int next = 0;
+    std::vector<Snapshot> history;
+    expect_eq("history before a torn slot", 1,
+              reader.read_since(next, history));
+    expect_eq("next after a torn slot", 2, next);
+  }
+}
+
+void test_takeover(const std::string &name) {
+  // A child publishes once and exits without unlinking its segment.
+  pid_t child = fork();
+  if (child == 0) {
+    TelemetryPublisher *orphan = new TelemetryPublisher(name, 4);
+    orphan->publish(numbered(1));
+    _exit(0);
+  }
+  int status = 0;
+  waitpid(child, &status, 0);
+  expect_eq("orphaning child exited", 1,
+            WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+  TelemetryReader stale(name);
+  expect_eq("orphaned publications", 1, stale.published());
+  {
+    TelemetryPublisher publisher(name, 8);
+    TelemetryReader reader(name);
+    expect_eq("new capacity", 8, reader.capacity());
+    expect_eq("new publications", 0, reader.published());
+    publisher.publish(numbered(2));
+
+    Snapshot snap;
+    expect_eq("stale reader latest", 1, stale.latest(snap));
+    expect_eq("stale reader emc freq", 1, snap.emc_freq);
+    expect_eq("new reader latest", 1, reader.latest(snap));
+    expect_eq("new reader emc freq", 2, snap.emc_freq);
+  }
+}
+
+} // namespace
+
+int main() {
+  FakeTree tree("telemetry");
+  return run_checks([] {
+    std::string name = "jetson_clocks_telemetry." + std::to_string(getpid());
+    test_telemetry(name);
+    test_takeover(name + ".takeover");
+    test_torn(name + ".torn");
+  });
+}
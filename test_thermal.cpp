@@ -0,0 +1,51 @@
+#include "test_util.hpp"
+#include <climits>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+using namespace jetson_clocks;
+
+// Checks that thermal zones are found in order with their trip points and
+// domains, and that headroom is measured to the lowest trip point that
+// throttles, both on demand and in snapshots.
+namespace {
+
+void test_thermal() {
+  std::vector<ThermalZone> zones = get_thermal_zones();
+  expect_eq("zones", 3, zones.size());
+  if (zones.size() != 3) {
+    return;
+  }
+  expect_eq("zone 0 domain", 1, zones[0].domain == "CPU");
+  expect_eq("zone 0 policy", 1, zones[0].policy == "step_wise");
+  expect_eq("zone 0 trips", 2, zones[0].trips.size());
+  expect_eq("zone 0 trip 1", 90000, zones[0].trips[1].temp_mc);
+  expect_eq("zone 2 domain", 1, zones[2].domain == "Tboard");
+
+  expect_eq("cpu temp", 45500, get_zone_temp("CPU"));
+  expect_eq("gpu temp by type", 44000, get_zone_temp("GPU-therm"));
+  // The passive trip is lower than the critical one.
+  expect_eq("cpu headroom", 44500, get_thermal_headroom("CPU"));
+  // The active trip only turns the fan up.
+  expect_eq("gpu headroom", 52800, get_thermal_headroom("GPU"));
+
+  expect_throws("headroom of a zone without trip points",
+                [&] { get_thermal_headroom("Tboard"); });
+
+  Snapshot snap = snapshot();
+  expect_eq("snapshot zones", 3, snap.num_zones);
+  expect_eq("snapshot zone type", 0, std::strcmp(snap.zones[1].type,
+                                                 "GPU-therm"));
+  expect_eq("snapshot gpu temp", 44000, snap.zones[1].temp_mc);
+  expect_eq("snapshot cpu headroom", 44500, snap.zones[0].headroom_mc);
+  expect_eq("snapshot Tboard headroom", LONG_MAX, snap.zones[2].headroom_mc);
+}
+
+} // namespace
+
+int main() {
+  FakeTree tree("thermal");
+  return run_checks(test_thermal);
+}
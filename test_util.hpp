@@ -0,0 +1,86 @@
+#ifndef JETSON_CLOCKS_TEST_UTIL_HPP_
+#define JETSON_CLOCKS_TEST_UTIL_HPP_
+
+#include "fake_tree.hpp"
+#include "jetson_clocks.hpp"
+#include <cmath>
+#include <cstdio>
+#include <string>
+#include <unistd.h>
+
+// What every test shares: failure counting, the expect_* checks, and a fake
+// tree that is removed when the test ends. A test is a main() that builds
+// what it needs and returns run_checks(...). Everything is inline, so a test
+// that does not use a helper does not warn about it.
+
+// The number of failed checks so far.
+inline int &failures() {
+  static int count = 0;
+  return count;
+}
+
+inline void expect_eq(const char *what, long int expected, long int actual) {
+  if (expected != actual) {
+    std::printf("FAIL %s: expected %ld, got %ld\n", what, expected, actual);
+    ++failures();
+  }
+}
+
+// Within tolerance of expected, relative to its size.
+inline void expect_near(const char *what, double expected, double actual,
+                        double tolerance = 1e-6) {
+  if (std::fabs(expected - actual) > tolerance * std::fabs(expected)) {
+    std::printf("FAIL %s: expected %g, got %g\n", what, expected, actual);
+    ++failures();
+  }
+}
+
+template <typename F> void expect_throws(const char *what, F f) {
+  try {
+    f();
+    std::printf("FAIL %s: did not throw\n", what);
+    ++failures();
+  } catch (jetson_clocks::JetsonClocksException &) {
+  }
+}
+
+// Run a test's checks, counting an escaped exception as a failure, and
+// return the process exit code.
+template <typename F> int run_checks(F f) {
+  try {
+    f();
+  } catch (jetson_clocks::JetsonClocksException &e) {
+    std::printf("FAIL %s\n", e.what());
+    ++failures();
+  }
+  return failures() == 0 ? 0 : 1;
+}
+
+// Builds the fake tree under /dev/shm/jetson_clocks_test_<name>.<pid>, points
+// the library at it, and removes it again on destruction. The platform is
+// detected on first use, so the tree can still be changed after this.
+class FakeTree {
+public:
+  explicit FakeTree(const std::string &name)
+      : root_("/dev/shm/jetson_clocks_test_" + name + "." +
+              std::to_string(getpid())) {
+    make_fake_tree(root_);
+    jetson_clocks::set_root_dir(root_);
+  }
+  ~FakeTree() { remove_tree(root_); }
+
+  FakeTree(const FakeTree &) = delete;
+  FakeTree &operator=(const FakeTree &) = delete;
+
+  const std::string &root() const { return root_; }
+
+  // Write an attribute of the tree.
+  void put(const std::string &path, const std::string &contents) const {
+    ::put(root_, path, contents);
+  }
+
+private:
+  std::string root_;
+};
+
+#endif
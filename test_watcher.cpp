@@ -0,0 +1,124 @@
+#include "test_util.hpp"
+#include <cstdio>
+#include <fcntl.h>
+#include <memory>
+#include <string>
+#include <unistd.h>
+
+using namespace jetson_clocks;
+
+// Checks the Watcher's polling on the fake tree, whose regular files cannot
+// notify: a change is called back exactly once, the interval backs off
+// while nothing changes and resets on a change, and a callback can watch,
+// unwatch and destroy the watcher without a freed descriptor or entry
+// being used afterwards.
+namespace {
+
+const char *emc_rate = "/sys/kernel/debug/bpmp/debug/clk/emc/rate";
+const char *cpu0_cur_freq =
+    "/sys/devices/system/cpu/cpu0/cpufreq/scaling_cur_freq";
+const char *cpu2_cur_freq =
+    "/sys/devices/system/cpu/cpu2/cpufreq/scaling_cur_freq";
+
+void test_poll(const FakeTree &tree) {
+  Watcher watcher(10, 80);
+  int calls = 0;
+  std::string seen;
+  watcher.watch(emc_rate, [&](const std::string &path,
+                              const std::string &value) {
+    ++calls;
+    seen = value;
+    expect_eq("called back for the watched path", 1, path == emc_rate);
+  });
+  expect_eq("first interval", 10, watcher.poll_interval_ms(emc_rate));
+
+  // Polls at 0, 20, 60 and 140 ms double the interval up to the maximum.
+  expect_eq("callbacks without a change", 0, watcher.wait(200));
+  expect_eq("backed off interval", 80, watcher.poll_interval_ms(emc_rate));
+
+  tree.put(emc_rate, "665600000\n");
+  expect_eq("callbacks for a change", 1, watcher.wait(500));
+  expect_eq("calls for a change", 1, calls);
+  expect_eq("new value", 1, seen == "665600000");
+  expect_eq("interval after a change", 10,
+            watcher.poll_interval_ms(emc_rate));
+  expect_eq("callbacks after the change", 0, watcher.wait(50));
+  expect_eq("calls after the change", 1, calls);
+
+  expect_throws("the interval of an unwatched path",
+                [&] { watcher.poll_interval_ms(cpu0_cur_freq); });
+}
+
+void test_unwatch(const FakeTree &tree) {
+  Watcher watcher(10, 80);
+  int emc_calls = 0;
+  int cpu0_calls = 0;
+  int cpu2_calls = 0;
+  watcher.watch(emc_rate, [&](const std::string &, const std::string &) {
+    ++emc_calls;
+    watcher.unwatch(emc_rate);
+    watcher.unwatch(cpu0_cur_freq);
+    watcher.watch(cpu2_cur_freq,
+                  [&](const std::string &, const std::string &) {
+                    ++cpu2_calls;
+                  });
+  });
+  watcher.watch(cpu0_cur_freq, [&](const std::string &, const std::string &) {
+    ++cpu0_calls;
+  });
+
+  tree.put(emc_rate, "1600000000\n");
+  tree.put(cpu0_cur_freq, "1420800\n");
+  expect_eq("callbacks before unwatching", 1, watcher.wait(500));
+  expect_eq("emc calls", 1, emc_calls);
+  expect_eq("no call after unwatching", 0, cpu0_calls);
+  expect_throws("the interval of an unwatched path",
+                [&] { watcher.poll_interval_ms(emc_rate); });
+
+  // A file opened now likely reuses a closed descriptor; it must not be
+  // read as the unwatched attribute.
+  int reused = open((tree.root() + "/proc/device-tree/model").c_str(),
+                    O_RDONLY);
+  tree.put(emc_rate, "2133000000\n");
+  tree.put(cpu0_cur_freq, "1907200\n");
+  expect_eq("callbacks after unwatching", 0, watcher.wait(50));
+  expect_eq("emc calls after unwatching", 1, emc_calls);
+  expect_eq("cpu0 calls after unwatching", 0, cpu0_calls);
+  if (reused >= 0) {
+    close(reused);
+  }
+
+  tree.put(cpu2_cur_freq, "1420800\n");
+  expect_eq("callbacks for a path watched in a callback", 1,
+            watcher.wait(500));
+  expect_eq("cpu2 calls", 1, cpu2_calls);
+}
+
+void test_destroy(const FakeTree &tree) {
+  std::unique_ptr<Watcher> watcher(new Watcher(10, 80));
+  int calls = 0;
+  auto destroy = [&](const std::string &, const std::string &) {
+    ++calls;
+    watcher.reset();
+  };
+  watcher->watch(emc_rate, destroy);
+  watcher->watch(cpu0_cur_freq, destroy);
+
+  tree.put(emc_rate, "1600000000\n");
+  tree.put(cpu0_cur_freq, "1420800\n");
+  Watcher *raw = watcher.get();
+  expect_eq("callbacks until destroyed", 1, raw->wait(500));
+  expect_eq("calls until destroyed", 1, calls);
+  expect_eq("destroyed", 1, watcher == nullptr);
+}
+
+} // namespace
+
+int main() {
+  FakeTree tree("watcher");
+  return run_checks([&] {
+    test_poll(tree);
+    test_unwatch(tree);
+    test_destroy(tree);
+  });
+}